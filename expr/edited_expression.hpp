@@ -5,6 +5,9 @@
 #include <cassert>
 #include <cmath>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include "../number_format.hpp"
 
 namespace Expression
 {    
@@ -26,6 +29,7 @@ namespace Expression
         
         virtual size_t size( void ) const = 0;
         virtual double get_expr_value() const = 0;
+        virtual double get_expr_value_from( double const * slots ) const = 0;
         virtual const_expr_ptr get_children( size_t i ) const = 0;
         virtual expr_ptr get_children( size_t i ) = 0;
         virtual void set_children( size_t , expr_ptr e ) = 0;
@@ -57,6 +61,7 @@ namespace Expression
         const_expr_ptr get_children( size_t i ) const override { assert( i == 0 ) ;return m_child; }
         expr_ptr get_children( size_t i ) override { assert( i == 0 ) ;return m_child; }
         double get_expr_value () const override { return m_child->get_expr_value(); }
+        double get_expr_value_from( double const * slots ) const override { return m_child->get_expr_value_from( slots ); }
         void set_children( size_t i , expr_ptr e ) override { assert( i == 0 ); m_child = e; }
     protected:
     
@@ -87,10 +92,11 @@ namespace Expression
         
         constant( double const & c ) : m_c( c ) {}
         double get_expr_value() const { return m_c; }
+        double get_expr_value_from( double const * ) const override { return m_c; }
         expression_type get_type( void ) const override { return expression_type::e_constant; }
         std::string to_string( void ) const override
         {
-            return std::to_string( m_c );
+            return format_double( m_c );
         }
         
     private:
@@ -108,14 +114,74 @@ namespace Expression
         variable( double const & const_value = 0 ): variable_name{ "var" + std::to_string( I ) }, variable_value( 0.0 ) { }
         expression_type get_type( void ) const override { return expression_type::e_variable; }
         double get_expr_value() const override { return variable_value.get_expr_value(); }
+        double get_expr_value_from( double const * ) const override { return variable_value.get_expr_value(); }
         std::string to_string( void ) const override { return variable_name; }
     };
     
+    /*
+     * Interns variable names: each distinct name is stored once and gets the next dense slot number, so a tree
+     * refers to its variables by slot and values are bound in a contiguous vector indexed by slot. The table keeps
+     * one such vector itself: bind() sets a value, 0.0 until then like a parsed variable had before slots, and
+     * evaluate_expr( e ) reads it, while evaluate_expr( e, table, slots ) takes the values from the caller.
+     */
+    class symbol_table
+    {
+    public:
+        static constexpr size_t npos = static_cast< size_t >( -1 );
+        
+        size_t intern( std::string const & name )
+        {
+            auto found = m_slots.find( name );
+            if( found != m_slots.end() ) return found->second;
+            m_names.push_back( name );
+            m_values.push_back( 0.0 );
+            m_slots.insert( { name, m_names.size() - 1 } );
+            return m_names.size() - 1;
+        }
+        void bind( size_t const & slot, double const & value ) { assert( slot < m_values.size() ); m_values[slot] = value; }
+        double value( size_t const & slot ) const { assert( slot < m_values.size() ); return m_values[slot]; }
+        std::vector< double > const & values( void ) const { return m_values; }
+        size_t find( std::string const & name ) const
+        {
+            auto found = m_slots.find( name );
+            return found == m_slots.end() ? npos : found->second;
+        }
+        std::string const & name( size_t const & slot ) const { assert( slot < m_names.size() ); return m_names[slot]; }
+        size_t size( void ) const { return m_names.size(); }
+        
+    private:
+        std::vector< std::string > m_names;
+        std::vector< double > m_values;
+        std::unordered_map< std::string, size_t > m_slots;
+    };
+    
+    using symbol_table_ptr = std::shared_ptr< symbol_table >;
+    
+    /*
+     * A variable that holds its slot instead of a name; the name lives once in the symbol_table. The node also
+     * shares ownership of the table ( 16 bytes, and one reference count increment when it is built ) so that
+     * to_string, to_polish and evaluate_expr( e ) work on a tree alone and the names outlive the parser's table.
+     * Evaluation with bound slots, get_expr_value_from, reads only the slot.
+     */
+    class slot_variable : public terminal_expr
+    {
+        size_t m_slot;
+        std::shared_ptr< symbol_table const > m_symbols;
+    public:
+        slot_variable( size_t const & slot, std::shared_ptr< symbol_table const > symbols ): m_slot( slot ), m_symbols( std::move( symbols ) ) { }
+        size_t get_slot( void ) const { return m_slot; }
+        expression_type get_type( void ) const override { return expression_type::e_variable; }
+        double get_expr_value() const override { return m_symbols->value( m_slot ); }
+        double get_expr_value_from( double const * slots ) const override { return slots[ m_slot ]; }
+        std::string to_string( void ) const override { return m_symbols->name( m_slot ); }
+    };
+    
     class sin_node : public unary_expr
     {
     public:
         sin_node( expr_ptr ptr ) : unary_expr{ ptr } { }
         double get_expr_value () const override { return std::sin( m_child->get_expr_value() ); }
+        double get_expr_value_from( double const * slots ) const override { return std::sin( m_child->get_expr_value_from( slots ) ); }
         expression_type get_type( void ) const override { return expression_type::e_unary_func; }
         std::string to_string( void ) const override { return std::string{ "sin" }; }
     };
@@ -125,6 +191,7 @@ namespace Expression
     public:
         cos_node( expr_ptr child ) : unary_expr{ child } { }
         double get_expr_value () const override { return std::cos( m_child->get_expr_value() ); }
+        double get_expr_value_from( double const * slots ) const override { return std::cos( m_child->get_expr_value_from( slots ) ); }
         expression_type get_type( void ) const override { return expression_type::e_unary_func; }
         std::string to_string( void ) const override { return std::string{ "cos" }; }
     };
@@ -145,6 +212,14 @@ namespace Expression
                 case '/': default: return m_children[0]->get_expr_value() / m_children[1]->get_expr_value();
             }
         }
+        double get_expr_value_from( double const * slots ) const override {
+            switch ( binary_op_type ) {
+                case '+': return m_children[0]->get_expr_value_from( slots ) + m_children[1]->get_expr_value_from( slots );
+                case '-': return m_children[0]->get_expr_value_from( slots ) - m_children[1]->get_expr_value_from( slots );
+                case '*': return m_children[0]->get_expr_value_from( slots ) * m_children[1]->get_expr_value_from( slots );
+                case '/': default: return m_children[0]->get_expr_value_from( slots ) / m_children[1]->get_expr_value_from( slots );
+            }
+        }
     };
     
     expr_ptr make_constant( double c ) { return std::make_shared< constant >( c ); }
@@ -157,6 +232,8 @@ namespace Expression
     
     expr_ptr make_variable( std::string const & str, double const & a = 0.0 ) { return std::make_shared< variable<> >( str, a ); }
     
+    expr_ptr make_slot_variable( size_t const & slot, std::shared_ptr< symbol_table const > symbols ) { return std::make_shared< slot_variable >( slot, std::move( symbols ) ); }
+    
     expr_ptr make_sin( expr_ptr child ) { return std::make_shared< sin_node >( child ); }
     expr_ptr make_cos( expr_ptr child ) { return std::make_shared< cos_node >( child ); }
     expr_ptr make_plus( expr_ptr left , expr_ptr right ) { return std::make_shared<binary_op_node<'+'> >( left , right ); }
@@ -2,6 +2,8 @@
 #define EDIT_EXPRESSIONS_IO_H_INCLUDED
 
 #include <sstream>
+#include <vector>
+#include <stdexcept>
 #include "lexer.hpp"
 
 namespace Expression {
@@ -9,9 +11,14 @@ namespace Expression {
     double evaluate_expr( const_expr_ptr ptr ){
         return ptr->get_expr_value();
     }
+    // slots[i] is the value of the variable interned at slot i of symbols, the table the tree was parsed into
+    double evaluate_expr( const_expr_ptr ptr, symbol_table const & symbols, std::vector<double> const & slots ){
+        if( slots.size() < symbols.size() ) throw std::out_of_range( "fewer slot values than interned variables" );
+        return ptr->get_expr_value_from( slots.data() );
+    }
     inline double to_double ( std::string const & str )
     {
-        return std::stod( str );
+        return parse_double( str );
     }
     
     inline void update_current_token( Lexer &lex, Lexer::token_type &token )
@@ -23,14 +30,14 @@ namespace Expression {
             token.second = expression_type::e_none;
         }
     }
-    expr_ptr build_unary_operator_or_variable_from( Lexer &lex, Lexer::token_type const & token )
+    expr_ptr build_unary_operator_or_variable_from( Lexer &lex, Lexer::token_type const & token, symbol_table_ptr const & symbols )
     {
         if( token.first.lexeme() == std::string { "cos" } ){
             return make_cos( nullptr );
         } else if( token.first.lexeme() == std::string { "sin" } ){
             return make_sin( nullptr );
         } else {
-            return make_variable( token.first.lexeme() );
+            return make_slot_variable( symbols->intern( token.first.lexeme() ), symbols );
         }
     }
     expr_ptr build_binary_operator_from( Lexer::token_type const & token )
@@ -48,48 +55,56 @@ namespace Expression {
         }
     }
     
-    expr_ptr convert_token_to_expression( Lexer &lex, Lexer::token_type const & token )
+    expr_ptr convert_token_to_expression( Lexer &lex, Lexer::token_type const & token, symbol_table_ptr const & symbols )
     {
         switch( token.second ){
             case expression_type::e_constant:           return make_constant( to_double( token.first.lexeme() ) );
             case expression_type::e_unary_func:
-            case expression_type::e_variable:           return build_unary_operator_or_variable_from( lex, token );
+            case expression_type::e_variable:           return build_unary_operator_or_variable_from( lex, token, symbols );
             case expression_type::e_binary_operator:    return build_binary_operator_from( token );
             case expression_type::e_none: default:      return nullptr;
         }
     }
-    inline expr_ptr get_root_node( Lexer & lex )
+    inline expr_ptr get_root_node( Lexer & lex, symbol_table_ptr const & symbols )
     {
-        return convert_token_to_expression( lex, lex.get_token() );
+        return convert_token_to_expression( lex, lex.get_token(), symbols );
     }
-    expr_ptr insert_child( expr_ptr node_to_insert, Lexer & lex, Lexer::token_type & token )
+    expr_ptr insert_child( expr_ptr node_to_insert, Lexer & lex, Lexer::token_type & token, symbol_table_ptr const & symbols )
     {
         auto curr_ptr = node_to_insert;
         if( curr_ptr ){
             for( size_t i = 0; i != curr_ptr->size(); ++i ){
                 update_current_token( lex, token );
-                node_to_insert = convert_token_to_expression( lex, token );
-                curr_ptr->set_children( i, insert_child( node_to_insert, lex, token ) );
+                node_to_insert = convert_token_to_expression( lex, token, symbols );
+                curr_ptr->set_children( i, insert_child( node_to_insert, lex, token, symbols ) );
             }
         }
         return curr_ptr;
     }
-    expr_ptr from_polish( std::string const & str, std::string const & separator = "|" )
+/*
+ * Variable names are interned into symbols at parse time: every occurrence of a name becomes a slot_variable
+ * with the same slot. Parse several expressions into one table to give them a common slot layout.
+ */
+    expr_ptr from_polish( std::string const & str, symbol_table_ptr const & symbols, std::string const & separator = "|" )
     {
         Lexer lex ( str );
         Lexer::token_type token;
         
-        expr_ptr root = get_root_node( lex );
+        expr_ptr root = get_root_node( lex, symbols );
         
         if( !lex.eof() ){
             for( size_t i = 0; i != root->size(); ++i ){
                 update_current_token( lex, token );
-                auto what_to_insert = convert_token_to_expression( lex, token );
-                root->set_children( i, insert_child( what_to_insert, lex, token ) );
+                auto what_to_insert = convert_token_to_expression( lex, token, symbols );
+                root->set_children( i, insert_child( what_to_insert, lex, token, symbols ) );
             }
         }
         return root;
     }
+    expr_ptr from_polish( std::string const & str, std::string const & separator = "|" )
+    {
+        return from_polish( str, std::make_shared< symbol_table >(), separator );
+    }
     inline void to_polish( std::ostream& out , const_expr_ptr e , std::string const& separator )
     {
         assert( e );
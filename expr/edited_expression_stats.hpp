@@ -0,0 +1,47 @@
+#ifndef EDIT_EXPRESSIONS_STATS_H_INCLUDED
+#define EDIT_EXPRESSIONS_STATS_H_INCLUDED
+
+#include "edited_expression.hpp"
+#include "../memory_statistics.hpp"
+
+namespace Expression {
+
+    /*
+     * Same report as ../expression_stats.hpp for the named variant. A variable made by make_variable owns its name, so
+     * string_bytes counts the heap buffer of names too long for the small string buffer; a parsed slot_variable holds
+     * its slot and a pointer to the symbol_table, which stores the name once and is not counted.
+     */
+    using memory_statistics = basic_memory_statistics< expression_type >;
+
+    namespace detail {
+
+        constexpr size_t small_string_capacity = 15; // libstdc++; names up to this length live inside the node
+
+        inline size_t payload_estimate( const_expr_ptr const & e )
+        {
+            switch( e->get_type() ){
+                case expression_type::e_constant:           return sizeof( constant );
+                case expression_type::e_variable:           return dynamic_cast< slot_variable const * >( e.get() ) ? sizeof( slot_variable ) : sizeof( variable<> );
+                case expression_type::e_binary_operator:    return sizeof( binary_op_node<'+'> );
+                case expression_type::e_unary_func:
+                case expression_type::e_none: default:      return sizeof( sin_node );
+            }
+        }
+
+        inline size_t string_estimate( const_expr_ptr const & e )
+        {
+            if( e->get_type() != expression_type::e_variable || dynamic_cast< slot_variable const * >( e.get() ) ) return 0;
+            std::string const name = e->to_string();
+            return name.size() <= small_string_capacity ? 0 : name.size() + 1;
+        }
+    } // namespace detail
+
+    inline memory_statistics memory_stats( const_expr_ptr const & root )
+    {
+        return detail::memory_walk< expression_type >( root,
+            []( const_expr_ptr const & e ){ return e->size(); },
+            []( const_expr_ptr const & e ){ return detail::payload_estimate( e ); },
+            []( const_expr_ptr const & e ){ return detail::string_estimate( e ); } );
+    }
+} //namespace Expression
+#endif
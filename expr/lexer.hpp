@@ -38,7 +38,7 @@ namespace Expression
         Symbol( std::string const & lex = "None" ): m_lexeme( lex ) { }
 
         std::string &get_lexeme() { return m_lexeme; }
-        const std::string lexeme() const { return m_lexeme; }
+        std::string const & lexeme() const { return m_lexeme; }
     private:
         std::string m_lexeme;
     };
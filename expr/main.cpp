@@ -0,0 +1,42 @@
+/*
+ * Demo of the named-variable variant: a shared symbol_table, slot variables and evaluation with bound values.
+ * It lives in its own executable because these headers define the same names in namespace Expression as the
+ * index-based tree used by ../main.cpp.
+ */
+
+#include "edited_expression_io.hpp"
+#include "edited_expression_stats.hpp"
+
+#include <iostream>
+
+using namespace Expression;
+
+int main( int argc , char *argv[] )
+{
+    auto symbols = std::make_shared< symbol_table >();
+    auto wave = from_polish( "+|sin|omega|*|amplitude|cos|omega", symbols );
+    auto drift = from_polish( "-|*|amplitude|time|omega", symbols );
+    std::cout << "Parsed " << to_polish( wave ) << " and " << to_polish( drift ) << " into " << symbols->size() << " slots:";
+    for( size_t slot = 0; slot != symbols->size(); ++slot ) std::cout << " " << symbols->name( slot ) << "=" << slot;
+    std::cout << std::endl;
+
+    std::cout << "Unbound: " << evaluate_expr( wave ) << ", " << evaluate_expr( drift ) << std::endl;
+    symbols->bind( symbols->find( "omega" ), 0.5 );
+    symbols->bind( symbols->find( "amplitude" ), 2.0 );
+    symbols->bind( symbols->find( "time" ), 3.0 );
+    std::vector< double > const slots = symbols->values();
+    std::cout << "Bound: " << evaluate_expr( wave ) << " == " << evaluate_expr( wave, *symbols, slots ) << ", "
+              << evaluate_expr( drift ) << " == " << evaluate_expr( drift, *symbols, slots ) << std::endl;
+
+    std::vector< double > other( slots.size(), 1.0 );
+    std::cout << "All ones: " << evaluate_expr( wave, *symbols, other ) << ", " << evaluate_expr( drift, *symbols, other ) << std::endl;
+    try {
+        evaluate_expr( wave, *symbols, std::vector< double >( 1, 1.0 ) );
+    } catch( std::out_of_range const & error ){
+        std::cout << "One value for " << symbols->size() << " slots: " << error.what() << std::endl;
+    }
+
+    auto stats = memory_stats( wave );
+    std::cout << "Wave: " << stats.unique_nodes << " nodes, depth " << stats.depth << ", " << stats.total_bytes() << " bytes" << std::endl;
+    return 0;
+}
@@ -0,0 +1,332 @@
+#ifndef EXPRESSION_CONSTEXPR_H_INCLUDED
+#define EXPRESSION_CONSTEXPR_H_INCLUDED
+
+#include "expressions.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+namespace Expression
+{
+    enum class polish_op
+    {
+        Constant,
+        Variable,
+        Plus,
+        Minus,
+        Multiplies,
+        Divides,
+        Sin,
+        Cos,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        Min,
+        Max,
+        Select
+    };
+
+    struct polish_instruction
+    {
+        polish_op op;
+        double value;
+        int index;
+    };
+
+    namespace detail {
+
+    /*
+     * Syntax errors. These are deliberately not constexpr: reaching one while the parser runs at compile time makes
+     * the expression non-constant, and the compiler reports the call by name.
+     */
+    inline size_t polish_unexpected_end_of_string() { throw std::invalid_argument( "incomplete Polish expression" ); }
+    inline size_t polish_trailing_tokens() { throw std::invalid_argument( "tokens after a complete Polish expression" ); }
+    inline size_t polish_invalid_token() { throw std::invalid_argument( "invalid token in Polish expression" ); }
+    inline polish_op polish_unknown_identifier() { throw std::invalid_argument( "identifier is neither sin, cos, min, max, select nor a variable" ); }
+    inline double polish_constant_not_exact_at_compile_time() { throw std::invalid_argument( "constant needs more than 53 bits or 22 decimals" ); }
+
+    constexpr bool polish_is_separator( char const c ) { return c == '|' || c == ' '; }
+    constexpr bool polish_is_digit( char const c ) { return c >= '0' && c <= '9'; }
+    constexpr bool polish_is_numeric( char const c ) { return polish_is_digit( c ) || c == '.'; }
+    constexpr bool polish_is_alpha( char const c ) { return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || c == '_'; }
+
+    constexpr size_t polish_skip( char const *s, size_t const i )
+    {
+        return polish_is_separator( s[i] ) ? polish_skip( s, i + 1 ) : i;
+    }
+
+    constexpr size_t polish_numeric_end( char const *s, size_t const i )
+    {
+        return polish_is_numeric( s[i] ) ? polish_numeric_end( s, i + 1 ) : i;
+    }
+
+    constexpr size_t polish_identifier_end( char const *s, size_t const i )
+    {
+        return polish_is_alpha( s[i] ) || polish_is_numeric( s[i] ) ? polish_identifier_end( s, i + 1 ) : i;
+    }
+
+    // End of the token starting at i, following the Lexer: '-' directly followed by a digit or '.' is a negative constant,
+    // '<' and '>' may be followed by '=', and '=' must be.
+    constexpr size_t polish_token_end( char const *s, size_t const i )
+    {
+        return s[i] == '\0' ? polish_unexpected_end_of_string()
+             : s[i] == '+' || s[i] == '*' || s[i] == '/' ? i + 1
+             : s[i] == '-' ? ( polish_is_numeric( s[ i + 1 ] ) ? polish_numeric_end( s, i + 1 ) : i + 1 )
+             : s[i] == '<' || s[i] == '>' ? ( s[ i + 1 ] == '=' ? i + 2 : i + 1 )
+             : s[i] == '=' ? ( s[ i + 1 ] == '=' ? i + 2 : polish_invalid_token() )
+             : polish_is_digit( s[i] ) ? polish_numeric_end( s, i + 1 )
+             : polish_is_alpha( s[i] ) ? polish_identifier_end( s, i + 1 )
+             : polish_invalid_token();
+    }
+
+    constexpr bool polish_matches( char const *s, size_t const i, size_t const end, char const *word )
+    {
+        return i == end ? *word == '\0' : ( *word != '\0' && s[i] == *word && polish_matches( s, i + 1, end, word + 1 ) );
+    }
+
+    constexpr size_t polish_first_digit( char const *s, size_t const i, size_t const end )
+    {
+        return i == end ? end : polish_is_digit( s[i] ) ? i : polish_first_digit( s, i + 1, end );
+    }
+
+    constexpr polish_op polish_token_op( char const *s, size_t const i, size_t const end )
+    {
+        return s[i] == '+' ? polish_op::Plus
+             : s[i] == '*' ? polish_op::Multiplies
+             : s[i] == '/' ? polish_op::Divides
+             : s[i] == '-' ? ( end == i + 1 ? polish_op::Minus : polish_op::Constant )
+             : s[i] == '<' ? ( end == i + 1 ? polish_op::Less : polish_op::LessEqual )
+             : s[i] == '>' ? ( end == i + 1 ? polish_op::Greater : polish_op::GreaterEqual )
+             : s[i] == '=' ? polish_op::Equal
+             : polish_is_digit( s[i] ) ? polish_op::Constant
+             : polish_matches( s, i, end, "sin" ) ? polish_op::Sin
+             : polish_matches( s, i, end, "cos" ) ? polish_op::Cos
+             : polish_matches( s, i, end, "min" ) ? polish_op::Min
+             : polish_matches( s, i, end, "max" ) ? polish_op::Max
+             : polish_matches( s, i, end, "select" ) ? polish_op::Select
+             : polish_first_digit( s, i, end ) != end ? polish_op::Variable
+             : polish_unknown_identifier();
+    }
+
+    constexpr size_t polish_arity( polish_op const op )
+    {
+        return op == polish_op::Constant || op == polish_op::Variable ? 0
+             : op == polish_op::Sin || op == polish_op::Cos ? 1
+             : op == polish_op::Select ? 3 : 2;
+    }
+
+    // Position just after the complete subexpression whose first token starts at i.
+    constexpr size_t polish_subtree_end( char const *s, size_t const i );
+
+    constexpr size_t polish_operands_end( char const *s, size_t const i, size_t const operands )
+    {
+        return operands == 0 ? i : polish_operands_end( s, polish_subtree_end( s, polish_skip( s, i ) ), operands - 1 );
+    }
+
+    constexpr size_t polish_subtree_end( char const *s, size_t const i )
+    {
+        return polish_operands_end( s, polish_token_end( s, i ), polish_arity( polish_token_op( s, i, polish_token_end( s, i ) ) ) );
+    }
+
+    constexpr size_t polish_count_tokens( char const *s, size_t const i )
+    {
+        return s[ polish_skip( s, i ) ] == '\0' ? 0 : 1 + polish_count_tokens( s, polish_token_end( s, polish_skip( s, i ) ) );
+    }
+
+    constexpr size_t polish_token_start( char const *s, size_t const i, size_t const k )
+    {
+        return k == 0 ? polish_skip( s, i ) : polish_token_start( s, polish_token_end( s, polish_skip( s, i ) ), k - 1 );
+    }
+
+    constexpr int polish_index( char const *s, size_t const i, size_t const end, int const acc )
+    {
+        return i != end && polish_is_digit( s[i] ) ? polish_index( s, i + 1, end, acc * 10 + ( s[i] - '0' ) ) : acc;
+    }
+
+    // Mantissa digits and fractional digit count of a constant, giving the same value as parse_double's exact path.
+    constexpr std::uint64_t polish_mantissa( char const *s, size_t const i, size_t const end, std::uint64_t const acc )
+    {
+        return i == end ? acc
+             : s[i] == '.' ? polish_mantissa( s, i + 1, end, acc )
+             : polish_mantissa( s, i + 1, end, acc * 10 + static_cast< std::uint64_t >( s[i] - '0' ) );
+    }
+
+    constexpr size_t polish_significant_digits( char const *s, size_t const i, size_t const end, size_t const count )
+    {
+        return i == end ? count
+             : s[i] == '.' || ( s[i] == '0' && count == 0 ) ? polish_significant_digits( s, i + 1, end, count )
+             : polish_significant_digits( s, i + 1, end, count + 1 );
+    }
+
+    constexpr int polish_fraction_digits( char const *s, size_t const i, size_t const end, bool const point, int const count )
+    {
+        return i == end ? count : s[i] == '.' ? polish_fraction_digits( s, i + 1, end, true, count )
+             : polish_fraction_digits( s, i + 1, end, point, point ? count + 1 : count );
+    }
+
+    constexpr double polish_power_of_ten( int const k )
+    {
+        return k == 0 ? 1.0 : 10.0 * polish_power_of_ten( k - 1 );
+    }
+
+    constexpr double polish_unsigned_constant( char const *s, size_t const i, size_t const end )
+    {
+        return polish_significant_digits( s, i, end, 0 ) <= 19 && polish_mantissa( s, i, end, 0 ) <= 9007199254740992ull
+                    && polish_fraction_digits( s, i, end, false, 0 ) <= 22
+             ? static_cast< double >( polish_mantissa( s, i, end, 0 ) ) / polish_power_of_ten( polish_fraction_digits( s, i, end, false, 0 ) )
+             : polish_constant_not_exact_at_compile_time();
+    }
+
+    constexpr double polish_constant( char const *s, size_t const i, size_t const end )
+    {
+        return s[i] == '-' ? -polish_unsigned_constant( s, i + 1, end ) : polish_unsigned_constant( s, i, end );
+    }
+
+    constexpr polish_instruction polish_make_instruction( char const *s, size_t const i, size_t const end, polish_op const op )
+    {
+        return polish_instruction { op, op == polish_op::Constant ? polish_constant( s, i, end ) : 0.0,
+                                    op == polish_op::Variable ? polish_index( s, polish_first_digit( s, i, end ), end, 0 ) : 0 };
+    }
+
+    constexpr polish_instruction polish_make_instruction( char const *s, size_t const i )
+    {
+        return polish_make_instruction( s, i, polish_token_end( s, i ), polish_token_op( s, i, polish_token_end( s, i ) ) );
+    }
+
+    constexpr size_t polish_token_inputs( polish_instruction const & in )
+    {
+        return in.op == polish_op::Variable ? static_cast< size_t >( in.index ) + 1 : 0;
+    }
+
+    constexpr size_t polish_max_inputs( char const *s, size_t const i, size_t const acc )
+    {
+        return s[ polish_skip( s, i ) ] == '\0' ? acc
+             : polish_max_inputs( s, polish_token_end( s, polish_skip( s, i ) ),
+                                  polish_token_inputs( polish_make_instruction( s, polish_skip( s, i ) ) ) > acc
+                                  ? polish_token_inputs( polish_make_instruction( s, polish_skip( s, i ) ) ) : acc );
+    }
+
+    template< size_t... I > struct index_list { };
+    template< size_t N, size_t... I > struct make_index_list : make_index_list< N - 1, N - 1, I... > { };
+    template< size_t... I > struct make_index_list< 0, I... > { using type = index_list< I... >; };
+
+    } // namespace detail
+
+/*
+ *
+ * name: polish_length
+ * @param: Polish string literal
+ * @return: number of tokens
+ * Also validates the string: it must hold exactly one complete expression, otherwise constant evaluation fails and,
+ * through POLISH_PROGRAM, so does compilation.
+ */
+    constexpr size_t polish_length( char const *s )
+    {
+        return s[ detail::polish_skip( s, detail::polish_subtree_end( s, detail::polish_skip( s, 0 ) ) ) ] != '\0'
+             ? detail::polish_trailing_tokens() : detail::polish_count_tokens( s, 0 );
+    }
+
+/*
+ *
+ * name: polish_inputs
+ * @param: Polish string literal
+ * @return: highest variable index plus one, 0 without variables
+ * Decodes every token, so a constant that cannot be converted exactly fails here, at compile time, as well.
+ */
+    constexpr size_t polish_inputs( char const *s )
+    {
+        return detail::polish_max_inputs( s, 0, 0 );
+    }
+
+/*
+ *
+ * name: polish_program
+ * The tokens of a Polish string, decoded at compile time into N fixed instructions in prefix order. evaluate() runs
+ * them right to left on an N-element stack array: no parsing, no tree and no allocation at run time, and the same
+ * operations in the same order as from_polish + evaluate_expr, so the results are identical. Inputs is the number
+ * of values a row must hold.
+ */
+    template< size_t N, size_t Inputs >
+    struct polish_program
+    {
+        polish_instruction code[N];
+
+        static constexpr size_t size( void ) { return N; }
+        static constexpr size_t inputs( void ) { return Inputs; }
+
+        // row[i] is the value of var<i>; row holds at least inputs() values
+        double evaluate( double const *row ) const
+        {
+            double stack[N];
+            size_t top = 0;
+            for( size_t i = N; i-- > 0; ){
+                polish_instruction const & in = code[i];
+                double left = 0.0, right = 0.0, third = 0.0;
+                switch( detail::polish_arity( in.op ) ){
+                    case 3: left = stack[ --top ]; right = stack[ --top ]; third = stack[ --top ]; break;
+                    case 2: left = stack[ --top ]; right = stack[ --top ]; break;
+                    case 1: left = stack[ --top ]; break;
+                    default: break;
+                }
+                switch( in.op ){
+                    case polish_op::Constant:     stack[ top++ ] = in.value; break;
+                    case polish_op::Variable:     stack[ top++ ] = row[ in.index ]; break;
+                    case polish_op::Plus:         stack[ top++ ] = left + right; break;
+                    case polish_op::Minus:        stack[ top++ ] = left - right; break;
+                    case polish_op::Multiplies:   stack[ top++ ] = left * right; break;
+                    case polish_op::Divides:      stack[ top++ ] = left / right; break;
+                    case polish_op::Sin:          stack[ top++ ] = std::sin( left ); break;
+                    case polish_op::Cos:          stack[ top++ ] = std::cos( left ); break;
+                    case polish_op::Less:         stack[ top++ ] = left < right ? 1.0 : 0.0; break;
+                    case polish_op::LessEqual:    stack[ top++ ] = left <= right ? 1.0 : 0.0; break;
+                    case polish_op::Greater:      stack[ top++ ] = left > right ? 1.0 : 0.0; break;
+                    case polish_op::GreaterEqual: stack[ top++ ] = left >= right ? 1.0 : 0.0; break;
+                    case polish_op::Equal:        stack[ top++ ] = left == right ? 1.0 : 0.0; break;
+                    case polish_op::Min:          stack[ top++ ] = std::min( left, right ); break;
+                    case polish_op::Max:          stack[ top++ ] = std::max( left, right ); break;
+                    case polish_op::Select:       stack[ top++ ] = left != 0.0 ? right : third; break;
+                }
+            }
+            assert( top == 1 );
+            return stack[0];
+        }
+
+        // with every variable bound to its context_expr_eval value, like evaluate_expr
+        double evaluate( void ) const
+        {
+            static_assert( Inputs <= 20, "context_expr_eval only binds var0 to var19" );
+            context_expr_eval const context {};
+            double row[20];
+            for( int i = 0; i != 20; ++i ) row[i] = context.get( i );
+            return evaluate( row );
+        }
+    };
+
+    template< size_t N, size_t Inputs, size_t... I >
+    constexpr polish_program< N, Inputs > make_polish_program( char const *s, detail::index_list< I... > )
+    {
+        return polish_program< N, Inputs > { { detail::polish_make_instruction( s, detail::polish_token_start( s, 0, I ) )... } };
+    }
+
+    template< size_t N, size_t Inputs >
+    constexpr polish_program< N, Inputs > make_polish_program( char const *s )
+    {
+        return make_polish_program< N, Inputs >( s, typename detail::make_index_list< N >::type {} );
+    }
+} // namespace Expression
+
+/*
+ * POLISH_PROGRAM( "*|+|var10|1|+|+|11|var1|sin|var10" ) is a constant expression of type polish_program< 10, 11 >.
+ * Both template arguments are computed in a constant context, which decodes and checks every token, so any error
+ * in the string fails the build even when the result initializes a non-constexpr variable. Parsing is recursive
+ * constexpr evaluation, so strings are limited by the compiler's constexpr depth ( 512 calls by default, roughly
+ * as many characters ).
+ * Constants are limited to parse_double's exact path: at most 19 significant digits whose value is at most 2^53,
+ * and at most 22 fractional digits. from_polish accepts longer constants through strtod, but they are rejected
+ * here rather than rounded differently.
+ */
+#define POLISH_PROGRAM( str ) ::Expression::make_polish_program< ::Expression::polish_length( str ), ::Expression::polish_inputs( str ) >( str )
+
+#endif // EXPRESSION_CONSTEXPR_H_INCLUDED
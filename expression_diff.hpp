@@ -0,0 +1,163 @@
+#ifndef EXPRESSION_DIFF_H_INCLUDED
+#define EXPRESSION_DIFF_H_INCLUDED
+
+#include "expression_persistent.hpp"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Expression
+{
+    // Replace the subtree at path by replacement.
+    struct expr_edit
+    {
+        expr_path path;
+        expr_ptr replacement;
+    };
+
+    // Edits address disjoint subtrees and are kept in preorder, which is the order diff produces them in.
+    using edit_script = std::vector< expr_edit >;
+
+    namespace detail {
+
+    // Two nodes have the same head when they differ at most in their children.
+    inline bool same_head( const_expr_ptr const & a, const_expr_ptr const & b )
+    {
+        if( a->get_type() != b->get_type() || a->num_children() != b->num_children() ) return false;
+        switch( a->get_type() ){
+            case Constant: {
+                double const x = a->eval(), y = b->eval();
+                return std::memcmp( &x, &y, sizeof( double ) ) == 0;
+            }
+            case Variable:  return get_variable_index( a ) == get_variable_index( b );
+            case UnaryFunc: case Comparison: return a->to_string() == b->to_string();
+            default:        return true;
+        }
+    }
+
+    // Returns whether both trees are equal; otherwise appends the replacements that turn before into after.
+    inline bool diff_impl( const_expr_ptr const & before, const_expr_ptr const & after, expr_path & path, edit_script & script )
+    {
+        if( before == after ) return true;
+        if( !same_head( before, after ) ){
+            script.push_back( expr_edit { path, std::const_pointer_cast< expr >( after ) } );
+            return false;
+        }
+        bool equal = true;
+        for( size_t i = 0; i != before->num_children(); ++i ){
+            path.push_back( i );
+            equal = diff_impl( before->get_children( i ), after->get_children( i ), path, script ) && equal;
+            path.pop_back();
+        }
+        return equal;
+    }
+
+    inline bool path_less( expr_edit const & a, expr_edit const & b ) { return a.path < b.path; }
+
+    // Rebuilds node with the edits in [ first, last ), whose paths all start with the first depth indices of node's path.
+    inline expr_ptr patch_impl( const_expr_ptr const & node, edit_script::const_iterator first, edit_script::const_iterator const & last,
+                                size_t const & depth )
+    {
+        if( first->path.size() == depth ){
+            if( last - first != 1 ) throw std::invalid_argument( "edit script replaces a subtree and also edits inside it" );
+            return first->replacement;
+        }
+        std::vector< expr_ptr > children( node->num_children() );
+        for( size_t i = 0; i != children.size(); ++i ) children[i] = std::const_pointer_cast< expr >( node->get_children( i ) );
+        while( first != last ){
+            size_t const child = first->path[ depth ];
+            if( child >= children.size() ) throw std::out_of_range( "edit script path leaves the tree" );
+            auto group_end = first;
+            while( group_end != last && group_end->path.size() > depth && group_end->path[ depth ] == child ) ++group_end;
+            children[ child ] = patch_impl( children[ child ], first, group_end, depth + 1 );
+            first = group_end;
+        }
+        return make_node_like( node, std::move( children ) );
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: diff
+ * @param: old tree, new tree
+ * @return: edit script
+ * Both trees are walked together from the root. Where the nodes have the same head ( type, arity and constant,
+ * variable or function ) the walk descends into the children, otherwise the whole subtree of the new tree becomes
+ * one replacement. Subtrees shared by pointer are skipped, so the cost is at most proportional to the smaller tree.
+ */
+    inline edit_script diff( const_expr_ptr const & before, const_expr_ptr const & after )
+    {
+        edit_script script {};
+        expr_path path {};
+        detail::diff_impl( before, after, path, script );
+        return script;
+    }
+
+/*
+ *
+ * name: patch
+ * @param: tree, edit script
+ * @return: patched tree
+ * Applies all edits in one pass: only the nodes on the paths to the edits are copied, everything else is shared
+ * with root, which is left unchanged. patch( a, diff( a, b ) ) is structurally equal to b.
+ */
+    inline expr_ptr patch( const_expr_ptr const & root, edit_script const & script )
+    {
+        if( script.empty() ) return std::const_pointer_cast< expr >( root );
+        if( std::is_sorted( script.begin(), script.end(), detail::path_less ) ){
+            return detail::patch_impl( root, script.begin(), script.end(), 0 );
+        }
+        edit_script sorted = script;
+        std::stable_sort( sorted.begin(), sorted.end(), detail::path_less );
+        return detail::patch_impl( root, sorted.begin(), sorted.end(), 0 );
+    }
+
+/*
+ *
+ * name: to_edit_string
+ * @param: edit script
+ * @return: one line per edit, the path as dot separated child indices, ':' and the replacement in Polish notation,
+ * e.g. "1.0.1:sin|var3". The root has an empty path.
+ */
+    inline std::string to_edit_string( edit_script const & script )
+    {
+        std::ostringstream out;
+        for( auto const & edit : script ){
+            for( size_t d = 0; d != edit.path.size(); ++d ) out << ( d ? "." : "" ) << edit.path[d];
+            out << ':';
+            to_polish( out, edit.replacement );
+            out << '\n';
+        }
+        return out.str();
+    }
+
+    inline edit_script from_edit_string( std::string const & str )
+    {
+        edit_script script {};
+        std::istringstream in { str };
+        std::string line {};
+        while( std::getline( in, line ) ){
+            if( line.empty() ) continue;
+            std::string::size_type const colon = line.find( ':' );
+            if( colon == std::string::npos ) throw std::invalid_argument( "edit without ':' separator" );
+            expr_edit edit {};
+            for( std::string::size_type i = 0; i < colon; ){
+                size_t index = 0;
+                std::string::size_type const start = i;
+                for( ; i < colon && line[i] >= '0' && line[i] <= '9'; ++i ) index = index * 10 + static_cast< size_t >( line[i] - '0' );
+                if( i == start || ( i < colon && line[i] != '.' ) ) throw std::invalid_argument( "malformed edit path" );
+                edit.path.push_back( index );
+                if( i < colon ) ++i;
+            }
+            edit.replacement = from_polish( line.substr( colon + 1 ) );
+            script.push_back( std::move( edit ) );
+        }
+        return script;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_DIFF_H_INCLUDED
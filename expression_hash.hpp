@@ -0,0 +1,93 @@
+#ifndef EXPRESSION_HASH_H_INCLUDED
+#define EXPRESSION_HASH_H_INCLUDED
+
+#include "expressions.hpp"
+#include <vector>
+#include <cstring>
+#include <unordered_map>
+
+namespace Expression
+{
+/*
+ *
+ * name: structurally_equal
+ * Same structure, constants ( bit for bit, so 0.0 and -0.0 differ ), variables and functions. Different cached hashes settle most unequal pairs at once;
+ * equal hashes are confirmed by a walk that skips subtrees shared by pointer, so a hash collision can never make
+ * two different trees compare equal.
+ */
+    inline bool structurally_equal( const_expr_ptr const & a, const_expr_ptr const & b )
+    {
+        if( a == b ) return true;
+        if( a->structural_hash() != b->structural_hash() ) return false;
+        if( a->get_type() != b->get_type() || a->num_children() != b->num_children() ) return false;
+        switch( a->get_type() ){
+            case Constant: {
+                double const x = a->eval(), y = b->eval();
+                return std::memcmp( &x, &y, sizeof( double ) ) == 0;
+            }
+            case Variable:  return get_variable_index( a ) == get_variable_index( b );
+            case UnaryFunc: case Comparison: if( a->to_string() != b->to_string() ) return false; break;
+            default: break;
+        }
+        for( size_t i = 0; i != a->num_children(); ++i ){
+            if( !structurally_equal( a->get_children( i ), b->get_children( i ) ) ) return false;
+        }
+        return true;
+    }
+
+    // Hasher and equality for unordered containers keyed by structure rather than by pointer.
+    struct expr_hash
+    {
+        size_t operator()( const_expr_ptr const & e ) const { return static_cast< size_t >( e->structural_hash() ); }
+    };
+
+    struct expr_equal
+    {
+        bool operator()( const_expr_ptr const & a, const_expr_ptr const & b ) const { return structurally_equal( a, b ); }
+    };
+
+    struct dedup_report
+    {
+        size_t expressions = 0;
+        size_t unique = 0;
+        size_t hash_collisions = 0;     // equal hashes of different structures
+    };
+
+/*
+ *
+ * name: deduplicate
+ * @param: corpus, optional report
+ * @return: for every expression the position of the first structurally equal one
+ * One hash table lookup per expression on the cached hashes; each hash is computed once in a single pass over the
+ * tree, and a full comparison only runs against a candidate with the same hash, so the total is near linear in the
+ * size of the corpus.
+ */
+    inline std::vector< size_t > deduplicate( std::vector< const_expr_ptr > const & corpus, dedup_report *report = nullptr )
+    {
+        dedup_report stats {};
+        stats.expressions = corpus.size();
+        std::vector< size_t > representative( corpus.size() );
+        std::unordered_multimap< std::uint64_t, size_t > seen {};
+        seen.reserve( corpus.size() );
+        for( size_t i = 0; i != corpus.size(); ++i ){
+            std::uint64_t const h = corpus[i]->structural_hash();
+            representative[i] = i;
+            auto range = seen.equal_range( h );
+            for( auto it = range.first; it != range.second; ++it ){
+                if( structurally_equal( corpus[ it->second ], corpus[i] ) ){
+                    representative[i] = it->second;
+                    break;
+                }
+                ++stats.hash_collisions;
+            }
+            if( representative[i] == i ){
+                seen.insert( { h, i } );
+                ++stats.unique;
+            }
+        }
+        if( report ) *report = stats;
+        return representative;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_HASH_H_INCLUDED
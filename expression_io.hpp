@@ -12,7 +12,10 @@
 
 #include "lexer.hpp"
 #include <sstream>
+#include <algorithm>
 #include <deque>
+#include <vector>
+#include <unordered_map>
 
 using namespace EditedExpression;
 
@@ -83,9 +86,78 @@ namespace Expression
         }
         return tree_to_build;
     }
+    namespace detail {
+    
+    inline expr_ptr flatten_impl( expr_ptr const & e, std::unordered_map< expr const *, expr_ptr > & done );
+    
+    inline bool same_group( expression_type const & group, expression_type const & type )
+    {
+        return group == Sum ? ( type == Plus || type == Sum ) : ( type == Multiplies || type == Product );
+    }
+    
+    inline expr_ptr flatten_group( expr_ptr const & e, expression_type const & group, std::unordered_map< expr const *, expr_ptr > & done )
+    {
+        std::vector< expr_ptr > operands {};
+        std::vector< expr_ptr > pending { e };
+        while( !pending.empty() ){
+            expr_ptr node = pending.back();
+            pending.pop_back();
+            if( same_group( group, node->get_type() ) ){
+                for( size_t i = node->num_children(); i-- > 0; ){
+                    pending.push_back( node->get_children( i ) );
+                }
+            } else {
+                operands.push_back( flatten_impl( node, done ) );
+            }
+        }
+        return group == Sum ? make_sum( std::move( operands ) ) : make_product( std::move( operands ) );
+    }
+    
+    inline expr_ptr flatten_impl( expr_ptr const & e, std::unordered_map< expr const *, expr_ptr > & done )
+    {
+        auto found = done.find( e.get() );
+        if( found != done.end() ) return found->second;
+        
+        expr_ptr result = nullptr;
+        switch( e->get_type() ){
+            case Plus: case Sum:
+                result = flatten_group( e, Sum, done ); break;
+            case Multiplies: case Product:
+                result = flatten_group( e, Product, done ); break;
+            case Constant: case Variable:
+                result = e; break;
+            default: {
+                std::vector< expr_ptr > children {};
+                for( size_t i = 0; i != e->num_children(); ++i ){
+                    children.push_back( flatten_impl( e->get_children( i ), done ) );
+                }
+                result = make_node_like( e, std::move( children ) );
+            }
+        }
+        done.insert( { e.get(), result } );
+        return result;
+    }
+    
+    } // namespace detail
+    
+/*
+ * 
+ * name: flatten
+ * @param: expression
+ * @return: flattened expression
+ * Collapses every nested run of + ( resp. * ) nodes into a single sum_node ( resp. product_node ) holding all the
+ * operands in one contiguous array, left to right. The input tree is not modified; leaves are shared. Operands are
+ * re-associated to the left, so ( a + ( b + c ) ) evaluates as ( ( a + b ) + c ) afterwards.
+ */
+    inline expr_ptr flatten( expr_ptr const & expression )
+    {
+        std::unordered_map< expr const *, expr_ptr > done {};
+        return detail::flatten_impl( expression, done );
+    }
+    
     inline double to_double ( std::string const & str )
     {
-        return std::stod( str );
+        return parse_double( str );
     }
     
     inline void update_current_token( Lexer &lex, Lexer::token_type &token )
@@ -109,8 +181,12 @@ namespace Expression
  */
     inline int get_index_from( std::string const & str )
     {
-        std::string::size_type found = str.find_first_of( "1234567890" );
-        return std::stoi( std::string { str.begin() + found, str.end() } );
+        int index = 0;
+        auto digit = str.begin();
+        while( digit != str.end() && ( *digit < '0' || *digit > '9' ) ) ++digit;
+        assert( digit != str.end() );
+        for( ; digit != str.end() && *digit >= '0' && *digit <= '9'; ++digit ) index = index * 10 + ( *digit - '0' );
+        return index;
     }
     expr_ptr build_unary_operator_or_variable_from( Lexer::token_type const & token )
     {
@@ -118,6 +194,12 @@ namespace Expression
             return make_cos( nullptr );
         } else if( token.first.lexeme() == std::string { "sin" } ){
             return make_sin( nullptr );
+        } else if( token.first.lexeme() == std::string { "min" } ){
+            return make_min( nullptr, nullptr );
+        } else if( token.first.lexeme() == std::string { "max" } ){
+            return make_max( nullptr, nullptr );
+        } else if( token.first.lexeme() == std::string { "select" } ){
+            return make_select( nullptr, nullptr, nullptr );
         } else {
             unsigned int const index = get_index_from( token.first.lexeme() );
             return make_variable_with_index<>( index );
@@ -135,6 +217,7 @@ namespace Expression
             case expression_type::Minus:                return make_minus( nullptr, nullptr );
             case expression_type::Divides:              return make_divided( nullptr, nullptr );
             case expression_type::Multiplies:           return make_multiplies( nullptr, nullptr );
+            case expression_type::Comparison:           return make_comparison( token.first.lexeme(), nullptr, nullptr );
         }
     }
     inline expr_ptr get_root_node( Lexer & lex )
@@ -173,6 +256,17 @@ namespace Expression
     inline void to_polish( std::ostream& out , const_expr_ptr e , std::string const& separator = "|" )
     {
         assert( e );
+        if( e->get_type() == Sum || e->get_type() == Product ){
+            // n-ary nodes are written as the equivalent left-leaning binary chain so from_polish can read them back
+            assert( e->num_children() > 0 );
+            for( size_t i = 1 ; i < e->num_children() ; ++i ) out << e->to_string() << separator;
+            for( size_t i = 0 ; i < e->num_children() ; ++i )
+            {
+                if( i != 0 ) out << separator;
+                to_polish( out , e->get_children(i) , separator );
+            }
+            return;
+        }
         out << e->to_string();
         for( size_t i=0 ; i<e->num_children() ; ++i )
         {
@@ -181,39 +275,71 @@ namespace Expression
         }
     }
     
-    inline double process_unary_function( const_expr_ptr e );
+    template< typename T = double > inline T process_unary_function( const_expr_ptr e );
+    template< typename T = double > inline T process_nary_function( const_expr_ptr e );
 
     inline double evaluate_expr( double const & c )
     {
         return c;
     }
-    inline double evaluate_expr( const_expr_ptr e )
+    
+    /*
+     * T is the scalar type the whole evaluation runs in. Constants and variable values are stored as double and
+     * converted on load, so evaluate_expr< float >( e ) performs every operation in single precision.
+     */
+    template< typename T = double >
+    inline T evaluate_expr( const_expr_ptr e )
     {
         switch ( e->get_type() ) {
             case Constant:
-                return e->eval();
+                return static_cast< T >( e->eval() );
             case Variable:
-                return e->eval();
+                return static_cast< T >( e->eval() );
             case Plus:
-                return evaluate_expr( e->get_children( 0 ) ) + evaluate_expr( e->get_children( 1 ) );
+                return evaluate_expr< T >( e->get_children( 0 ) ) + evaluate_expr< T >( e->get_children( 1 ) );
             case Minus:
-                return evaluate_expr( e->get_children( 0 ) ) - evaluate_expr( e->get_children( 1 ) );
+                return evaluate_expr< T >( e->get_children( 0 ) ) - evaluate_expr< T >( e->get_children( 1 ) );
             case Divides:
-                return evaluate_expr( e->get_children( 0 ) ) / evaluate_expr( e->get_children( 1 ) );
+                return evaluate_expr< T >( e->get_children( 0 ) ) / evaluate_expr< T >( e->get_children( 1 ) );
             case Multiplies:
-                return evaluate_expr( e->get_children( 0 ) ) * evaluate_expr( e->get_children( 1 ) );
+                return evaluate_expr< T >( e->get_children( 0 ) ) * evaluate_expr< T >( e->get_children( 1 ) );
+            case Sum: case Product:
+                return process_nary_function< T >( e );
+            case Comparison:
+                return compare_values( e->to_string(), evaluate_expr< T >( e->get_children( 0 ) ), evaluate_expr< T >( e->get_children( 1 ) ) ) ? T( 1 ) : T( 0 );
+            case Min:
+                return std::min( evaluate_expr< T >( e->get_children( 0 ) ), evaluate_expr< T >( e->get_children( 1 ) ) );
+            case Max:
+                return std::max( evaluate_expr< T >( e->get_children( 0 ) ), evaluate_expr< T >( e->get_children( 1 ) ) );
+            case Select:
+                return evaluate_expr< T >( e->get_children( 0 ) ) != T( 0 ) ? evaluate_expr< T >( e->get_children( 1 ) ) : evaluate_expr< T >( e->get_children( 2 ) );
             case UnaryFunc: default:
-                return process_unary_function( e );
+                return process_unary_function< T >( e );
         }
     }
     
-    inline double process_unary_function( const_expr_ptr e )
+    template< typename T >
+    inline T process_unary_function( const_expr_ptr e )
     {
         if( e->to_string() == std::string { "cos" } ){
-            return std::cos( evaluate_expr( e->get_children( 0 ) ) );
+            return std::cos( evaluate_expr< T >( e->get_children( 0 ) ) );
+        } else {
+            return std::sin( evaluate_expr< T >( e->get_children( 0 ) ) );
+        }
+    }
+    
+    template< typename T >
+    inline T process_nary_function( const_expr_ptr e )
+    {
+        auto const & children = static_cast< nary_expr const * >( e.get() )->children();
+        assert( !children.empty() );
+        T result = evaluate_expr< T >( children[0] );
+        if( e->get_type() == Sum ){
+            for( size_t i = 1; i < children.size(); ++i ) result += evaluate_expr< T >( children[i] );
         } else {
-            return std::sin( evaluate_expr( e->get_children( 0 ) ) );
+            for( size_t i = 1; i < children.size(); ++i ) result *= evaluate_expr< T >( children[i] );
         }
+        return result;
     }
     inline std::string to_polish( const_expr_ptr e , std::string const& separator = "|" )
     {
@@ -0,0 +1,283 @@
+#ifndef EXPRESSION_PARALLEL_H_INCLUDED
+#define EXPRESSION_PARALLEL_H_INCLUDED
+
+#include "expression_plan.hpp"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#if defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Expression
+{
+/*
+ *
+ * name: work_stealing_pool
+ * Runs parallel_for jobs on a fixed set of threads; the calling thread takes part as worker 0, so a pool of one
+ * thread starts nothing. Every worker starts with an equal contiguous range of chunk indices and takes chunks
+ * from the front of its own range; when it runs dry it steals the back half of the largest range left. A range is
+ * a single atomic word ( first and last chunk ), so owner and thieves agree through compare-and-swap only.
+ * With pin_threads the background threads are bound to one core each ( Linux only, ignored elsewhere ).
+ */
+    class work_stealing_pool
+    {
+        // padded to a cache line of its own, so workers taking chunks do not slow each other down
+        struct chunk_range
+        {
+            std::atomic< std::uint64_t > bounds;
+            char padding[ 64 - sizeof( std::atomic< std::uint64_t > ) ];
+        };
+
+        static std::uint64_t pack( std::uint64_t const & first, std::uint64_t const & last ) { return first << 32 | last; }
+        static std::uint64_t first_of( std::uint64_t const & bounds ) { return bounds >> 32; }
+        static std::uint64_t last_of( std::uint64_t const & bounds ) { return bounds & 0xffffffffu; }
+
+    public:
+        using job_type = std::function< void( size_t worker, size_t chunk ) >;
+
+        explicit work_stealing_pool( size_t const & threads = std::thread::hardware_concurrency(), bool const & pin_threads = false )
+        : m_ranges( new chunk_range[ threads ? threads : 1 ] ), m_size{ threads ? threads : 1 }, m_threads{}, m_mutex{},
+          m_wake{}, m_finished{}, m_job{ nullptr }, m_generation{ 0 }, m_running{ 0 }, m_remaining{ 0 }, m_steals{ 0 }, m_stop{ false }
+        {
+            for( size_t w = 0; w != m_size; ++w ) m_ranges[w].bounds.store( 0 );
+            for( size_t w = 1; w != m_size; ++w ){
+                m_threads.emplace_back( [this, w]{ worker_loop( w ); } );
+                if( pin_threads ) pin( m_threads.back(), w );
+            }
+        }
+        work_stealing_pool( work_stealing_pool const & ) = delete;
+        work_stealing_pool & operator=( work_stealing_pool const & ) = delete;
+
+        ~work_stealing_pool()
+        {
+            {
+                std::lock_guard< std::mutex > lock { m_mutex };
+                m_stop = true;
+            }
+            m_wake.notify_all();
+            for( auto & thread : m_threads ) thread.join();
+        }
+
+        size_t size( void ) const { return m_size; }
+        size_t steals( void ) const { return m_steals.load(); } // chunk ranges stolen since the pool started
+
+        // Calls job( worker, chunk ) once for every chunk in [ 0, chunks ) and returns when all calls have returned.
+        void parallel_for( size_t const & chunks, job_type const & job )
+        {
+            assert( chunks < ( std::uint64_t( 1 ) << 32 ) );
+            if( chunks == 0 ) return;
+            for( size_t w = 0; w != m_size; ++w ){
+                m_ranges[w].bounds.store( pack( chunks * w / m_size, chunks * ( w + 1 ) / m_size ), std::memory_order_relaxed );
+            }
+            m_remaining.store( chunks, std::memory_order_relaxed );
+            {
+                std::lock_guard< std::mutex > lock { m_mutex };
+                m_job = &job;
+                m_running = m_size - 1;
+                ++m_generation;
+            }
+            m_wake.notify_all();
+            work( 0, job );
+            std::unique_lock< std::mutex > lock { m_mutex };
+            m_finished.wait( lock, [this]{ return m_running == 0; } );
+            m_job = nullptr;
+        }
+
+    private:
+
+        static void pin( std::thread & thread, size_t const & worker )
+        {
+#if defined( __linux__ )
+            unsigned const cores = std::thread::hardware_concurrency();
+            cpu_set_t set;
+            CPU_ZERO( &set );
+            CPU_SET( cores ? worker % cores : 0, &set );
+            pthread_setaffinity_np( thread.native_handle(), sizeof( set ), &set );
+#else
+            (void) thread; (void) worker;
+#endif
+        }
+
+        void worker_loop( size_t const & worker )
+        {
+            size_t seen = 0;
+            for( ; ; ){
+                job_type const *job = nullptr;
+                {
+                    std::unique_lock< std::mutex > lock { m_mutex };
+                    m_wake.wait( lock, [&]{ return m_stop || m_generation != seen; } );
+                    if( m_stop ) return;
+                    seen = m_generation;
+                    job = m_job;
+                }
+                work( worker, *job );
+                std::lock_guard< std::mutex > lock { m_mutex };
+                if( --m_running == 0 ) m_finished.notify_one();
+            }
+        }
+
+        bool take_own( size_t const & worker, size_t & chunk )
+        {
+            std::atomic< std::uint64_t > & own = m_ranges[ worker ].bounds;
+            std::uint64_t bounds = own.load( std::memory_order_acquire );
+            while( first_of( bounds ) < last_of( bounds ) ){
+                if( own.compare_exchange_weak( bounds, pack( first_of( bounds ) + 1, last_of( bounds ) ), std::memory_order_acq_rel ) ){
+                    chunk = first_of( bounds );
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Moves the back half of the largest other range into the thief's own, which is empty at this point.
+        bool steal( size_t const & thief )
+        {
+            for( ; ; ){
+                size_t victim = m_size;
+                std::uint64_t victim_bounds = 0, largest = 0;
+                for( size_t w = 0; w != m_size; ++w ){
+                    std::uint64_t const bounds = m_ranges[w].bounds.load( std::memory_order_acquire );
+                    std::uint64_t const left = last_of( bounds ) - first_of( bounds );
+                    if( w != thief && first_of( bounds ) < last_of( bounds ) && left > largest ){
+                        victim = w;
+                        victim_bounds = bounds;
+                        largest = left;
+                    }
+                }
+                if( victim == m_size ) return false;
+                std::uint64_t const split = last_of( victim_bounds ) - ( largest + 1 ) / 2;
+                if( m_ranges[ victim ].bounds.compare_exchange_strong( victim_bounds, pack( first_of( victim_bounds ), split ), std::memory_order_acq_rel ) ){
+                    m_ranges[ thief ].bounds.store( pack( split, last_of( victim_bounds ) ), std::memory_order_release );
+                    m_steals.fetch_add( 1, std::memory_order_relaxed );
+                    return true;
+                }
+            }
+        }
+
+        void work( size_t const & worker, job_type const & job )
+        {
+            size_t chunk = 0;
+            while( m_remaining.load( std::memory_order_acquire ) != 0 ){
+                if( take_own( worker, chunk ) ){
+                    job( worker, chunk );
+                    m_remaining.fetch_sub( 1, std::memory_order_acq_rel );
+                } else if( !steal( worker ) ){
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        std::unique_ptr< chunk_range[] > m_ranges;
+        size_t m_size;
+        std::vector< std::thread > m_threads;
+        std::mutex m_mutex;
+        std::condition_variable m_wake, m_finished;
+        job_type const *m_job;
+        size_t m_generation;
+        size_t m_running;
+        alignas( 64 ) std::atomic< size_t > m_remaining;
+        alignas( 64 ) std::atomic< size_t > m_steals;
+        bool m_stop;
+    };
+
+    namespace detail {
+
+    // Everything one worker touches while evaluating, padded so that neighbouring workers never share a cache line.
+    template< typename T >
+    struct parallel_scratch
+    {
+        basic_plan_workspace< T > ws;
+        std::vector< T const * > columns;
+        std::vector< T * > outputs;
+        char padding[64];
+    };
+
+    } // namespace detail
+
+/*
+ *
+ * name: evaluate_parallel
+ * @param: plan, input columns, number of rows, output columns, pool, rows per chunk
+ * Row-sharded evaluate_batch: rows are cut into chunks of chunk_rows ( rounded up to whole blocks of
+ * evaluation_plan::block_size ) and the chunks are scheduled on the pool. Each worker evaluates with its own
+ * workspace, and since chunks are whole blocks of rows, workers write disjoint, block-aligned parts of the outputs.
+ * The results are identical to evaluate_batch.
+ */
+    template< typename T >
+    inline void evaluate_parallel( evaluation_plan const & plan, T const * const *columns, size_t const & rows, T * const *outputs,
+                                   work_stealing_pool & pool, size_t chunk_rows = 64 * evaluation_plan::block_size )
+    {
+        size_t const block = evaluation_plan::block_size;
+        chunk_rows = chunk_rows < block ? block : ( chunk_rows + block - 1 ) / block * block;
+        size_t const chunks = ( rows + chunk_rows - 1 ) / chunk_rows;
+
+        std::vector< detail::parallel_scratch< T > > scratch( pool.size() );
+        for( auto & s : scratch ){
+            s.columns.resize( plan.num_inputs() );
+            s.outputs.resize( plan.num_outputs() );
+        }
+        pool.parallel_for( chunks, [&]( size_t const worker, size_t const chunk ){
+            detail::parallel_scratch< T > & s = scratch[ worker ];
+            size_t const first = chunk * chunk_rows;
+            size_t const n = rows - first < chunk_rows ? rows - first : chunk_rows;
+            for( size_t i = 0; i != s.columns.size(); ++i ) s.columns[i] = columns[i] + first;
+            for( size_t k = 0; k != s.outputs.size(); ++k ) s.outputs[k] = outputs[k] + first;
+            plan.evaluate_batch( s.columns.data(), n, s.outputs.data(), s.ws );
+        } );
+    }
+
+    struct scaling_point
+    {
+        size_t threads;
+        double ns_per_row;
+        double speedup;         // relative to the first point
+        size_t steals;
+    };
+
+    // Evaluation time per row for every thread count from 1 to max_threads, each with its own pool.
+    inline std::vector< scaling_point > time_parallel( evaluation_plan const & plan, size_t const & rows = 1 << 22,
+                                                       size_t const & max_threads = std::thread::hardware_concurrency(),
+                                                       bool const & pin_threads = false, size_t const & repeats = 4 )
+    {
+        std::vector< double > const row = default_bindings( plan.num_inputs() );
+        std::vector< std::vector< double > > input( plan.num_inputs() ), output( plan.num_outputs(), std::vector< double >( rows ) );
+        std::vector< double const * > columns;
+        std::vector< double * > outputs;
+        for( size_t i = 0; i != input.size(); ++i ){
+            input[i].assign( rows, row[i] );
+            columns.push_back( input[i].data() );
+        }
+        for( auto & column : output ) outputs.push_back( column.data() );
+
+        std::vector< scaling_point > points {};
+        for( size_t threads = 1; threads <= ( max_threads ? max_threads : 1 ); ++threads ){
+            work_stealing_pool pool { threads, pin_threads };
+            evaluate_parallel( plan, columns.data(), rows, outputs.data(), pool );
+            auto const start = std::chrono::steady_clock::now();
+            for( size_t r = 0; r != repeats; ++r ) evaluate_parallel( plan, columns.data(), rows, outputs.data(), pool );
+            std::chrono::duration< double, std::nano > const elapsed = std::chrono::steady_clock::now() - start;
+            double const ns = elapsed.count() / ( rows * repeats );
+            points.push_back( scaling_point { threads, ns, points.empty() ? 1.0 : points.front().ns_per_row / ns, pool.steals() } );
+        }
+        return points;
+    }
+
+    inline std::ostream & operator<<( std::ostream & os, std::vector< scaling_point > const & points )
+    {
+        for( auto const & p : points ){
+            os << "  " << p.threads << " threads: " << p.ns_per_row << " ns/row, speedup " << p.speedup << ", " << p.steals << " steals\n";
+        }
+        return os;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_PARALLEL_H_INCLUDED
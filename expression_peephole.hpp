@@ -0,0 +1,181 @@
+#ifndef EXPRESSION_PEEPHOLE_H_INCLUDED
+#define EXPRESSION_PEEPHOLE_H_INCLUDED
+
+#include "expression_plan.hpp"
+
+namespace Expression
+{
+    /*
+     * fuse_multiply_add and power_chains change the rounding of the result in the last bit, divide_by_reciprocal
+     * may change it by one ulp as well, which is why it is off by default. Fusing is only enabled by default when
+     * the target has a hardware fma ( FP_FAST_FMA ), otherwise std::fma is a slow library call.
+     */
+    struct peephole_options
+    {
+#ifdef FP_FAST_FMA
+        bool fuse_multiply_add = true;
+#else
+        bool fuse_multiply_add = false;
+#endif
+        bool divide_by_reciprocal = false;
+        bool power_chains = true;
+    };
+
+    struct peephole_report
+    {
+        size_t ops_before = 0, ops_after = 0;
+        size_t fused_multiply_adds = 0, reciprocals = 0, power_chains = 0;
+        double ns_per_row_before = 0.0, ns_per_row_after = 0.0;
+    };
+
+    namespace detail {
+
+    struct power_form
+    {
+        size_t base;
+        size_t exponent;
+    };
+
+    inline plan_instruction make_instruction( plan_opcode op, size_t lhs = 0, size_t rhs = 0, size_t aux = 0 )
+    {
+        return plan_instruction { op, lhs, rhs, 0.0, 0, aux };
+    }
+
+    inline plan_instruction remap( plan_instruction in, std::vector< size_t > const & slot )
+    {
+        size_t const n = num_operands( in.op );
+        if( n > 0 ) in.lhs = slot[ in.lhs ];
+        if( n > 1 ) in.rhs = slot[ in.rhs ];
+        if( n > 2 ) in.aux = slot[ in.aux ];
+        return in;
+    }
+
+    template< typename Function >
+    inline void for_each_operand( plan_instruction const & in, Function f )
+    {
+        size_t const n = num_operands( in.op );
+        if( n > 0 ) f( in.lhs );
+        if( n > 1 ) f( in.rhs );
+        if( n > 2 ) f( in.aux );
+    }
+
+    // x^n by repeated squaring, n >= 1
+    inline size_t emit_power( evaluation_plan & out, size_t base, size_t exponent )
+    {
+        size_t result = 0;
+        bool has_result = false;
+        while( exponent ){
+            if( exponent & 1 ){
+                result = has_result ? out.append( make_instruction( plan_opcode::Multiplies, result, base ) ) : base;
+                has_result = true;
+            }
+            exponent >>= 1;
+            if( exponent ) base = out.append( make_instruction( plan_opcode::Square, base ) );
+        }
+        return result;
+    }
+
+    // Drops every instruction no output depends on and renumbers the remaining ones.
+    inline evaluation_plan prune( evaluation_plan const & plan )
+    {
+        auto const & program = plan.program();
+        std::vector< bool > live( program.size(), false );
+        for( auto const & slot : plan.outputs() ) live[slot] = true;
+        for( size_t i = program.size(); i-- > 0; ){
+            if( live[i] ) for_each_operand( program[i], [&]( size_t const & j ){ live[j] = true; } );
+        }
+        evaluation_plan result {};
+        std::vector< size_t > slot( program.size(), 0 );
+        for( size_t i = 0; i != program.size(); ++i ){
+            if( live[i] ) slot[i] = result.append( remap( program[i], slot ) );
+        }
+        for( auto const & output : plan.outputs() ) result.add_output( slot[ output ] );
+        return result;
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: lower_peephole
+ * @param: plan, options, optional report
+ * @return: rewritten plan
+ * Strength-reduction over a compiled plan: a*b + c becomes one MultiplyAdd, x / c becomes x * (1/c), and chains of
+ * products of the same operand ( x*x*x*x ) become square sequences. A product is only absorbed when nothing else
+ * reads it; dead instructions are removed afterwards.
+ */
+    inline evaluation_plan lower_peephole( evaluation_plan const & plan, peephole_options const & options = peephole_options {},
+                                           peephole_report *report = nullptr )
+    {
+        auto const & program = plan.program();
+        std::vector< size_t > uses( program.size(), 0 );
+        for( auto const & in : program ){
+            detail::for_each_operand( in, [&]( size_t const & j ){ ++uses[j]; } );
+        }
+        for( auto const & slot : plan.outputs() ) ++uses[ slot ];
+
+        peephole_report stats {};
+        evaluation_plan lowered {};
+        std::vector< size_t > slot( program.size(), 0 );
+        std::vector< detail::power_form > power( program.size() );
+
+        auto is_single_use_product = [&]( size_t const & i ){
+            return program[i].op == plan_opcode::Multiplies && uses[i] == 1;
+        };
+
+        for( size_t i = 0; i != program.size(); ++i ){
+            plan_instruction const & in = program[i];
+            power[i] = detail::power_form { i, 1 };
+
+            if( in.op == plan_opcode::Multiplies && options.power_chains ){
+                auto operand_power = [&]( size_t const & j ){
+                    return is_single_use_product( j ) ? power[j] : detail::power_form { j, 1 };
+                };
+                detail::power_form const l = operand_power( in.lhs ), r = operand_power( in.rhs );
+                if( l.base == r.base ){
+                    power[i] = detail::power_form { l.base, l.exponent + r.exponent };
+                    slot[i] = detail::emit_power( lowered, slot[ l.base ], power[i].exponent );
+                    ++stats.power_chains;
+                    continue;
+                }
+            }
+            if( in.op == plan_opcode::Plus && options.fuse_multiply_add ){
+                size_t product = in.lhs, addend = in.rhs;
+                if( !is_single_use_product( product ) ) std::swap( product, addend );
+                if( is_single_use_product( product ) ){
+                    plan_instruction const & mul = program[ product ];
+                    slot[i] = lowered.append( detail::make_instruction( plan_opcode::MultiplyAdd,
+                                                slot[ mul.lhs ], slot[ mul.rhs ], slot[ addend ] ) );
+                    ++stats.fused_multiply_adds;
+                    continue;
+                }
+            }
+            if( in.op == plan_opcode::Divides && options.divide_by_reciprocal && program[ in.rhs ].op == plan_opcode::Constant ){
+                plan_instruction reciprocal = program[ in.rhs ];
+                reciprocal.value = 1.0 / reciprocal.value;
+                size_t const factor = lowered.append( reciprocal );
+                slot[i] = lowered.append( detail::make_instruction( plan_opcode::Multiplies, slot[ in.lhs ], factor ) );
+                ++stats.reciprocals;
+                continue;
+            }
+            slot[i] = lowered.append( detail::remap( in, slot ) );
+        }
+        for( auto const & output : plan.outputs() ) lowered.add_output( slot[ output ] );
+
+        evaluation_plan result = detail::prune( lowered );
+        if( report ){
+            stats.ops_before = plan.num_operations();
+            stats.ops_after = result.num_operations();
+            *report = stats;
+        }
+        return result;
+    }
+
+    inline void time_peephole( evaluation_plan const & before, evaluation_plan const & after, peephole_report & report )
+    {
+        report.ns_per_row_before = time_plan( before );
+        report.ns_per_row_after = time_plan( after );
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_PEEPHOLE_H_INCLUDED
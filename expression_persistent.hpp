@@ -0,0 +1,100 @@
+#ifndef EXPRESSION_PERSISTENT_H_INCLUDED
+#define EXPRESSION_PERSISTENT_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <memory>
+#include <vector>
+
+namespace Expression
+{
+    // Child indices from the root down to a node; the empty path is the root itself.
+    using expr_path = std::vector< size_t >;
+
+    inline const_expr_ptr subtree_at( const_expr_ptr root , expr_path const & path )
+    {
+        for( auto const & i : path ){
+            assert( root && i < root->num_children() );
+            root = root->get_children( i );
+        }
+        return root;
+    }
+
+    /*
+     * A persistent tree is never modified after it has been shared, which is what makes handing out
+     * const_expr_ptr safe; the casts below only let unchanged children be adopted by a new parent.
+     */
+    inline expr_ptr copy_with_child( const_expr_ptr const & node , size_t const & i , expr_ptr child )
+    {
+        std::vector< expr_ptr > children( node->num_children() );
+        for( size_t k = 0; k != children.size(); ++k ){
+            children[k] = k == i ? std::move( child ) : std::const_pointer_cast< expr >( node->get_children( k ) );
+        }
+        return make_node_like( node , std::move( children ) );
+    }
+
+/*
+ *
+ * name: replace_at
+ * @param: root, path, replacement
+ * @return: new root
+ * Path copying: only the nodes from the root down to the parent of the replaced subtree are copied, everything
+ * else is shared with the original, which stays valid and unchanged. Costs O( depth ) nodes ( times the arity of
+ * n-ary nodes on the path ).
+ */
+    inline expr_ptr replace_at( const_expr_ptr const & root , expr_path const & path , expr_ptr replacement )
+    {
+        std::vector< const_expr_ptr > spine { root };
+        for( size_t d = 0; d + 1 < path.size(); ++d ){
+            assert( path[d] < spine.back()->num_children() );
+            spine.push_back( spine.back()->get_children( path[d] ) );
+        }
+        expr_ptr result = std::move( replacement );
+        for( size_t d = path.size(); d-- > 0; ){
+            result = copy_with_child( spine[d] , path[d] , std::move( result ) );
+        }
+        return result;
+    }
+
+/*
+ *
+ * name: persistent_expr
+ * Versioned handle on an immutable expression tree. snapshot() hands out the current version; replace() builds the
+ * next one by path copying and publishes it atomically, retrying if another writer published first. Root and
+ * version number are published together as one immutable state, so the order of the version numbers is the order
+ * in which the roots were published. Readers holding an older snapshot keep evaluating it undisturbed, and it is
+ * freed when the last of them lets go.
+ */
+    class persistent_expr
+    {
+    public:
+        struct versioned_root
+        {
+            const_expr_ptr root;
+            size_t version;
+        };
+
+        explicit persistent_expr( const_expr_ptr root )
+        : m_state{ std::make_shared< versioned_root const >( versioned_root { std::move( root ), 0 } ) } { }
+        persistent_expr( persistent_expr const & ) = delete;
+        persistent_expr & operator=( persistent_expr const & ) = delete;
+
+        const_expr_ptr snapshot( void ) const { return current().root; }
+        size_t version( void ) const { return current().version; }
+        // root and the version it was published as, read together
+        versioned_root current( void ) const { return *std::atomic_load( &m_state ); }
+
+        size_t replace( expr_path const & path , expr_ptr replacement )
+        {
+            std::shared_ptr< versioned_root const > state = std::atomic_load( &m_state );
+            for( ; ; ){
+                auto next = std::make_shared< versioned_root const >( versioned_root { replace_at( state->root , path , replacement ), state->version + 1 } );
+                if( std::atomic_compare_exchange_strong( &m_state , &state , next ) ) return next->version;
+            }
+        }
+
+    private:
+        std::shared_ptr< versioned_root const > m_state;
+    };
+} // namespace Expression
+
+#endif // EXPRESSION_PERSISTENT_H_INCLUDED
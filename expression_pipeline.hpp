@@ -0,0 +1,343 @@
+#ifndef EXPRESSION_PIPELINE_H_INCLUDED
+#define EXPRESSION_PIPELINE_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <ostream>
+
+namespace Expression
+{
+/*
+ *
+ * name: bounded_queue
+ * Fixed-capacity multi-producer multi-consumer queue ( D. Vyukov's sequence-numbered ring ). Neither side ever
+ * blocks or locks: try_push fails when the ring is full, which is what gives the pipeline its back-pressure, and
+ * try_pop fails when it is empty. The capacity is rounded up to a power of two.
+ */
+    template< typename T >
+    class bounded_queue
+    {
+        struct cell
+        {
+            std::atomic< size_t > sequence;
+            T data;
+        };
+
+    public:
+        explicit bounded_queue( size_t const & capacity )
+        : m_capacity{ 1 }, m_cells{}, m_enqueue{ 0 }, m_dequeue{ 0 }
+        {
+            while( m_capacity < capacity ) m_capacity <<= 1;
+            m_cells.reset( new cell[ m_capacity ] );
+            for( size_t i = 0; i != m_capacity; ++i ) m_cells[i].sequence.store( i, std::memory_order_relaxed );
+        }
+        bounded_queue( bounded_queue const & ) = delete;
+        bounded_queue & operator=( bounded_queue const & ) = delete;
+
+        size_t capacity( void ) const { return m_capacity; }
+        size_t size_approx( void ) const
+        {
+            size_t const tail = m_dequeue.load( std::memory_order_relaxed );
+            size_t const head = m_enqueue.load( std::memory_order_relaxed );
+            return head > tail ? head - tail : 0;
+        }
+
+        // value is only moved from when the push succeeds
+        bool try_push( T && value )
+        {
+            size_t position = m_enqueue.load( std::memory_order_relaxed );
+            for( ; ; ){
+                cell & c = m_cells[ position & ( m_capacity - 1 ) ];
+                size_t const sequence = c.sequence.load( std::memory_order_acquire );
+                if( sequence == position ){
+                    if( m_enqueue.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ){
+                        c.data = std::move( value );
+                        c.sequence.store( position + 1, std::memory_order_release );
+                        return true;
+                    }
+                } else if( sequence < position ){
+                    return false;
+                } else {
+                    position = m_enqueue.load( std::memory_order_relaxed );
+                }
+            }
+        }
+
+        bool try_pop( T & value )
+        {
+            size_t position = m_dequeue.load( std::memory_order_relaxed );
+            for( ; ; ){
+                cell & c = m_cells[ position & ( m_capacity - 1 ) ];
+                size_t const sequence = c.sequence.load( std::memory_order_acquire );
+                if( sequence == position + 1 ){
+                    if( m_dequeue.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ){
+                        value = std::move( c.data );
+                        c.sequence.store( position + m_capacity, std::memory_order_release );
+                        return true;
+                    }
+                } else if( sequence < position + 1 ){
+                    return false;
+                } else {
+                    position = m_dequeue.load( std::memory_order_relaxed );
+                }
+            }
+        }
+
+    private:
+        size_t m_capacity;
+        std::unique_ptr< cell[] > m_cells;
+        alignas( 64 ) std::atomic< size_t > m_enqueue;
+        alignas( 64 ) std::atomic< size_t > m_dequeue;
+    };
+
+    struct pipeline_options
+    {
+        size_t parse_workers = 1;
+        size_t prepare_workers = 1;
+        size_t evaluate_workers = 1;
+        size_t queue_capacity = 1024;
+        bool linearize = false;     // linearize every tree whose root is a Plus node
+    };
+
+    struct stage_statistics
+    {
+        size_t workers = 0;
+        size_t items = 0;
+        double seconds = 0.0;           // from the first item started to the last one finished
+        double busy = 0.0;              // fraction of workers * seconds spent processing items
+        double p50_ns = 0.0, p90_ns = 0.0, p99_ns = 0.0;
+
+        double throughput( void ) const { return seconds > 0.0 ? items / seconds : 0.0; }
+    };
+
+    struct queue_statistics
+    {
+        size_t capacity = 0;
+        double mean_occupancy = 0.0;    // sampled by the producer at every push
+        size_t max_occupancy = 0;
+        size_t full_waits = 0;          // pushes that had to wait for room
+    };
+
+    struct pipeline_report
+    {
+        stage_statistics parse, prepare, evaluate;
+        queue_statistics parsed, prepared;
+        double p50_latency_ns = 0.0, p99_latency_ns = 0.0;  // end to end, parse start to result
+        double seconds = 0.0;
+    };
+
+    namespace detail {
+
+    using pipeline_clock = std::chrono::steady_clock;
+
+    struct pipeline_item
+    {
+        size_t index;
+        expr_ptr tree;
+        pipeline_clock::time_point started;
+    };
+
+    struct worker_record
+    {
+        std::vector< double > service_ns;
+        std::vector< double > latency_ns;
+        pipeline_clock::time_point first, last;
+        double busy_ns = 0.0;
+        size_t occupancy_sum = 0, occupancy_max = 0, pushes = 0, full_waits = 0;
+    };
+
+    inline double percentile( std::vector< double > & values, double const & p )
+    {
+        if( values.empty() ) return 0.0;
+        size_t const k = std::min( values.size() - 1, static_cast< size_t >( p * values.size() ) );
+        std::nth_element( values.begin(), values.begin() + k, values.end() );
+        return values[k];
+    }
+
+    inline void push_with_backpressure( bounded_queue< pipeline_item > & queue, pipeline_item && item, worker_record & record )
+    {
+        size_t const occupancy = queue.size_approx();
+        record.occupancy_sum += occupancy;
+        record.occupancy_max = std::max( record.occupancy_max, occupancy );
+        ++record.pushes;
+        if( queue.try_push( std::move( item ) ) ) return;
+        ++record.full_waits;
+        while( !queue.try_push( std::move( item ) ) ) std::this_thread::yield();
+    }
+
+    // Runs body on every item of input until the input is drained and its producers have all finished.
+    template< typename Body >
+    inline void consume( bounded_queue< pipeline_item > & input, std::atomic< bool > const & input_done, Body body )
+    {
+        pipeline_item item {};
+        for( ; ; ){
+            if( input.try_pop( item ) ){
+                body( std::move( item ) );
+            } else if( input_done.load( std::memory_order_acquire ) ){
+                if( !input.try_pop( item ) ) return;
+                body( std::move( item ) );
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    inline stage_statistics summarize( std::vector< worker_record > & records )
+    {
+        stage_statistics stats {};
+        stats.workers = records.size();
+        std::vector< double > all {};
+        double busy_ns = 0.0;
+        bool any = false;
+        pipeline_clock::time_point first {}, last {};
+        for( auto & record : records ){
+            if( record.service_ns.empty() ) continue;
+            all.insert( all.end(), record.service_ns.begin(), record.service_ns.end() );
+            busy_ns += record.busy_ns;
+            first = any ? std::min( first, record.first ) : record.first;
+            last = any ? std::max( last, record.last ) : record.last;
+            any = true;
+        }
+        stats.items = all.size();
+        stats.seconds = any ? std::chrono::duration< double >( last - first ).count() : 0.0;
+        stats.busy = stats.seconds > 0.0 ? busy_ns * 1e-9 / ( stats.seconds * stats.workers ) : 0.0;
+        stats.p50_ns = percentile( all, 0.50 );
+        stats.p90_ns = percentile( all, 0.90 );
+        stats.p99_ns = percentile( all, 0.99 );
+        return stats;
+    }
+
+    inline queue_statistics summarize( std::vector< worker_record > const & producers, size_t const & capacity )
+    {
+        queue_statistics stats {};
+        stats.capacity = capacity;
+        size_t sum = 0, pushes = 0;
+        for( auto const & record : producers ){
+            sum += record.occupancy_sum;
+            pushes += record.pushes;
+            stats.max_occupancy = std::max( stats.max_occupancy, record.occupancy_max );
+            stats.full_waits += record.full_waits;
+        }
+        stats.mean_occupancy = pushes ? static_cast< double >( sum ) / pushes : 0.0;
+        return stats;
+    }
+
+    template< typename Body >
+    inline void timed( worker_record & record, Body body )
+    {
+        auto const start = pipeline_clock::now();
+        body();
+        auto const stop = pipeline_clock::now();
+        double const ns = std::chrono::duration< double, std::nano >( stop - start ).count();
+        if( record.service_ns.empty() ) record.first = start;
+        record.last = stop;
+        record.service_ns.push_back( ns );
+        record.busy_ns += ns;
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: run_pipeline
+ * @param: Polish strings, options, optional report
+ * @return: one result per input, in input order
+ * Runs from_polish, the optional linearize and evaluate_expr as three concurrent stages, each with its own number
+ * of worker threads, connected by bounded lock-free queues. A full queue makes its producers wait, so a slow stage
+ * throttles the ones before it instead of letting memory grow. The report gives per-stage throughput, busy
+ * fraction and service-time percentiles, plus queue occupancy, which together show which stage to scale.
+ */
+    inline std::vector< double > run_pipeline( std::vector< std::string > const & input, pipeline_options const & options = pipeline_options {},
+                                              pipeline_report *report = nullptr )
+    {
+        using detail::pipeline_item;
+        using detail::worker_record;
+
+        assert( options.parse_workers > 0 && options.prepare_workers > 0 && options.evaluate_workers > 0 );
+        std::vector< double > results( input.size() );
+        bounded_queue< pipeline_item > parsed { options.queue_capacity }, prepared { options.queue_capacity };
+        std::atomic< size_t > next_input { 0 };
+        std::atomic< size_t > parsing { options.parse_workers }, preparing { options.prepare_workers };
+        std::atomic< bool > parse_done { false }, prepare_done { false };
+
+        std::vector< worker_record > parse_records( options.parse_workers ), prepare_records( options.prepare_workers ),
+                                     evaluate_records( options.evaluate_workers );
+        std::vector< std::thread > threads {};
+        auto const start = detail::pipeline_clock::now();
+
+        for( size_t w = 0; w != options.parse_workers; ++w ){
+            threads.emplace_back( [&, w](){
+                worker_record & record = parse_records[w];
+                for( size_t i = next_input++; i < input.size(); i = next_input++ ){
+                    pipeline_item item { i, nullptr, detail::pipeline_clock::now() };
+                    detail::timed( record, [&](){ item.tree = from_polish( input[i] ); } );
+                    detail::push_with_backpressure( parsed, std::move( item ), record );
+                }
+                if( --parsing == 0 ) parse_done.store( true, std::memory_order_release );
+            } );
+        }
+        for( size_t w = 0; w != options.prepare_workers; ++w ){
+            threads.emplace_back( [&, w](){
+                worker_record & record = prepare_records[w];
+                detail::consume( parsed, parse_done, [&]( pipeline_item && item ){
+                    detail::timed( record, [&](){
+                        if( options.linearize && item.tree->get_type() == Plus ) item.tree = linearize( item.tree );
+                    } );
+                    detail::push_with_backpressure( prepared, std::move( item ), record );
+                } );
+                if( --preparing == 0 ) prepare_done.store( true, std::memory_order_release );
+            } );
+        }
+        for( size_t w = 0; w != options.evaluate_workers; ++w ){
+            threads.emplace_back( [&, w](){
+                worker_record & record = evaluate_records[w];
+                detail::consume( prepared, prepare_done, [&]( pipeline_item && item ){
+                    detail::timed( record, [&](){ results[ item.index ] = evaluate_expr( item.tree ); } );
+                    record.latency_ns.push_back( std::chrono::duration< double, std::nano >( record.last - item.started ).count() );
+                    item.tree.reset();
+                } );
+            } );
+        }
+        for( auto & thread : threads ) thread.join();
+
+        if( report ){
+            report->seconds = std::chrono::duration< double >( detail::pipeline_clock::now() - start ).count();
+            report->parse = detail::summarize( parse_records );
+            report->prepare = detail::summarize( prepare_records );
+            report->evaluate = detail::summarize( evaluate_records );
+            report->parsed = detail::summarize( parse_records, parsed.capacity() );
+            report->prepared = detail::summarize( prepare_records, prepared.capacity() );
+            std::vector< double > latency {};
+            for( auto const & record : evaluate_records ) latency.insert( latency.end(), record.latency_ns.begin(), record.latency_ns.end() );
+            report->p50_latency_ns = detail::percentile( latency, 0.50 );
+            report->p99_latency_ns = detail::percentile( latency, 0.99 );
+        }
+        return results;
+    }
+
+    inline std::ostream & operator<<( std::ostream & out, pipeline_report const & report )
+    {
+        auto stage = [&]( char const * name, stage_statistics const & s ){
+            out << "  " << name << ": " << s.workers << " workers, " << s.items << " items, " << s.throughput() << " items/s, busy "
+                << s.busy * 100.0 << "%, p50/p90/p99 " << s.p50_ns << "/" << s.p90_ns << "/" << s.p99_ns << " ns\n";
+        };
+        auto queue = [&]( char const * name, queue_statistics const & q ){
+            out << "  " << name << " queue: mean " << q.mean_occupancy << " / max " << q.max_occupancy << " of " << q.capacity
+                << ", " << q.full_waits << " full waits\n";
+        };
+        out << "pipeline: " << report.seconds << " s, latency p50/p99 " << report.p50_latency_ns << "/" << report.p99_latency_ns << " ns\n";
+        stage( "parse", report.parse );
+        queue( "parsed", report.parsed );
+        stage( "prepare", report.prepare );
+        queue( "prepared", report.prepared );
+        stage( "evaluate", report.evaluate );
+        return out;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_PIPELINE_H_INCLUDED
@@ -0,0 +1,412 @@
+#ifndef EXPRESSION_PLAN_H_INCLUDED
+#define EXPRESSION_PLAN_H_INCLUDED
+
+#include "expression_io.hpp"
+#include "expression_trig.hpp"
+#include <vector>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+
+namespace Expression
+{
+    enum class plan_opcode
+    {
+        Constant,
+        Variable,
+        Plus,
+        Minus,
+        Multiplies,
+        Divides,
+        Sin,
+        Cos,
+        Square,
+        MultiplyAdd,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        Min,
+        Max,
+        Select
+    };
+
+    /*
+     * One step of an evaluation_plan. Every instruction writes exactly one slot ( its own position in the
+     * program ), operands refer to the slots of earlier instructions. Only MultiplyAdd ( lhs * rhs + aux ) and
+     * Select ( lhs != 0 ? rhs : aux ) use the third operand. Comparisons yield 1 or 0.
+     */
+    struct plan_instruction
+    {
+        plan_opcode op;
+        size_t lhs, rhs;
+        double value;
+        int index;
+        size_t aux;
+    };
+
+    inline size_t num_operands( plan_opcode const & op )
+    {
+        switch( op ){
+            case plan_opcode::Constant: case plan_opcode::Variable:                     return 0;
+            case plan_opcode::Sin: case plan_opcode::Cos: case plan_opcode::Square:     return 1;
+            case plan_opcode::MultiplyAdd: case plan_opcode::Select:                    return 3;
+            default:                                                                    return 2;
+        }
+    }
+
+    // trig selects how evaluate_batch computes sin and cos; the default keeps it identical to evaluate_expr.
+    template< typename T >
+    struct basic_plan_workspace
+    {
+        std::vector<T> slots;
+        trig_accuracy trig = trig_accuracy::accurate;
+    };
+
+    using plan_workspace = basic_plan_workspace<double>;
+
+    namespace detail {
+
+    template< typename T > struct same_size_uint;
+    template<> struct same_size_uint< float > { using type = std::uint32_t; };
+    template<> struct same_size_uint< double > { using type = std::uint64_t; };
+
+    /*
+     * dst[j] = c[j] != 0 ? a[j] : b[j] as a bit mask blend: both operands are loaded and one is masked out, so
+     * there is no per-row branch and the loop vectorizes into compare and and/andnot/or ( or blend ) instructions.
+     */
+    template< typename T >
+    inline void select_block( T const *c, T const *a, T const *b, T *dst, size_t const & n )
+    {
+        using U = typename same_size_uint< T >::type;
+        for( size_t j = 0; j != n; ++j ){
+            U const mask = U( 0 ) - static_cast< U >( c[j] != T( 0 ) );
+            U x, y;
+            std::memcpy( &x, &a[j], sizeof( U ) );
+            std::memcpy( &y, &b[j], sizeof( U ) );
+            U const r = ( x & mask ) | ( y & ~mask );
+            std::memcpy( &dst[j], &r, sizeof( U ) );
+        }
+    }
+
+    } // namespace detail
+
+    inline std::vector<double> default_bindings( size_t const & num_inputs )
+    {
+        context_expr_eval context {};
+        std::vector<double> row( num_inputs );
+        for( size_t i = 0; i != num_inputs; ++i ){
+            row[i] = context.get( i );
+        }
+        return row;
+    }
+
+/*
+ *
+ * name: evaluation_plan
+ * Compiles a set of expression roots into one straight-line program. Identical subexpressions ( e.g. sin(var10)
+ * appearing in several roots ) are hash-consed into a single instruction, so each is computed once per row, and
+ * every root becomes an output slot. Inputs are bound by variable index: row[i] is the value of var<i>.
+ */
+    class evaluation_plan
+    {
+    public:
+        static constexpr size_t block_size = 256;
+
+        evaluation_plan() = default;
+        explicit evaluation_plan( std::vector< const_expr_ptr > const & roots )
+        {
+            for( auto const & root : roots ) add_root( root );
+        }
+
+        size_t add_root( const_expr_ptr const & root )
+        {
+            assert( root );
+            m_outputs.push_back( compile( root ) );
+            m_visited.clear();
+            return m_outputs.size() - 1;
+        }
+
+        size_t num_outputs( void ) const { return m_outputs.size(); }
+        size_t num_instructions( void ) const { return m_program.size(); }
+        size_t num_inputs( void ) const { return m_num_inputs; }
+        std::vector< plan_instruction > const & program( void ) const { return m_program; }
+        std::vector< size_t > const & outputs( void ) const { return m_outputs; }
+
+        // Number of arithmetic and function instructions, i.e. everything except constant and variable loads.
+        size_t num_operations( void ) const
+        {
+            size_t count = 0;
+            for( auto const & in : m_program ){
+                if( in.op != plan_opcode::Constant && in.op != plan_opcode::Variable ) ++count;
+            }
+            return count;
+        }
+
+        /*
+         * Low-level construction used by plan rewriting passes: append() returns the slot of an instruction,
+         * reusing an identical one if it already exists, and add_output() marks a slot as the next output.
+         */
+        size_t append( plan_instruction const & in )
+        {
+            std::uint64_t bits = 0;
+            std::memcpy( &bits, &in.value, sizeof( bits ) );
+            instruction_key const key { static_cast<int>( in.op ), in.lhs, in.rhs, bits, in.index, in.aux };
+            auto found = m_shared.find( key );
+            if( found != m_shared.end() ) return found->second;
+
+            if( in.op == plan_opcode::Variable ){
+                m_num_inputs = std::max( m_num_inputs, static_cast<size_t>( in.index ) + 1 );
+            }
+            m_program.push_back( in );
+            m_shared.insert( { key, m_program.size() - 1 } );
+            return m_program.size() - 1;
+        }
+
+        size_t add_output( size_t const & slot )
+        {
+            assert( slot < m_program.size() );
+            m_outputs.push_back( slot );
+            return m_outputs.size() - 1;
+        }
+
+        /*
+         * The evaluators are templates on the scalar type T: with T = float every slot, input and output is
+         * single precision and constants are converted once per instruction.
+         */
+        template< typename T >
+        void evaluate( T const *row, T *outputs, basic_plan_workspace<T> & ws ) const
+        {
+            ws.slots.resize( m_program.size() );
+            T *slots = ws.slots.data();
+            for( size_t i = 0; i != m_program.size(); ++i ){
+                plan_instruction const & in = m_program[i];
+                switch( in.op ){
+                    case plan_opcode::Constant:     slots[i] = static_cast<T>( in.value ); break;
+                    case plan_opcode::Variable:     slots[i] = row[ in.index ]; break;
+                    case plan_opcode::Plus:         slots[i] = slots[ in.lhs ] + slots[ in.rhs ]; break;
+                    case plan_opcode::Minus:        slots[i] = slots[ in.lhs ] - slots[ in.rhs ]; break;
+                    case plan_opcode::Multiplies:   slots[i] = slots[ in.lhs ] * slots[ in.rhs ]; break;
+                    case plan_opcode::Divides:      slots[i] = slots[ in.lhs ] / slots[ in.rhs ]; break;
+                    case plan_opcode::Sin:          slots[i] = std::sin( slots[ in.lhs ] ); break;
+                    case plan_opcode::Cos:          slots[i] = std::cos( slots[ in.lhs ] ); break;
+                    case plan_opcode::Square:       slots[i] = slots[ in.lhs ] * slots[ in.lhs ]; break;
+                    case plan_opcode::MultiplyAdd:  slots[i] = std::fma( slots[ in.lhs ], slots[ in.rhs ], slots[ in.aux ] ); break;
+                    case plan_opcode::Less:         slots[i] = static_cast<T>( slots[ in.lhs ] < slots[ in.rhs ] ); break;
+                    case plan_opcode::LessEqual:    slots[i] = static_cast<T>( slots[ in.lhs ] <= slots[ in.rhs ] ); break;
+                    case plan_opcode::Greater:      slots[i] = static_cast<T>( slots[ in.lhs ] > slots[ in.rhs ] ); break;
+                    case plan_opcode::GreaterEqual: slots[i] = static_cast<T>( slots[ in.lhs ] >= slots[ in.rhs ] ); break;
+                    case plan_opcode::Equal:        slots[i] = static_cast<T>( slots[ in.lhs ] == slots[ in.rhs ] ); break;
+                    case plan_opcode::Min:          slots[i] = std::min( slots[ in.lhs ], slots[ in.rhs ] ); break;
+                    case plan_opcode::Max:          slots[i] = std::max( slots[ in.lhs ], slots[ in.rhs ] ); break;
+                    case plan_opcode::Select:       detail::select_block( &slots[ in.lhs ], &slots[ in.rhs ], &slots[ in.aux ], &slots[i], 1 ); break;
+                }
+            }
+            for( size_t k = 0; k != m_outputs.size(); ++k ){
+                outputs[k] = slots[ m_outputs[k] ];
+            }
+        }
+
+        template< typename T >
+        std::vector<T> evaluate( std::vector<T> const & row ) const
+        {
+            assert( row.size() >= m_num_inputs );
+            basic_plan_workspace<T> ws {};
+            std::vector<T> result( m_outputs.size() );
+            evaluate( row.data(), result.data(), ws );
+            return result;
+        }
+
+        std::vector<double> evaluate( void ) const
+        {
+            return evaluate( default_bindings( m_num_inputs ) );
+        }
+
+        /*
+         * Columnar batch: columns[i] points to the values of var<i> for all rows, outputs[k] receives root k.
+         * Rows are processed in blocks of block_size, one instruction at a time over the whole block.
+         */
+        template< typename T >
+        void evaluate_batch( T const * const *columns, size_t const & rows, T * const *outputs, basic_plan_workspace<T> & ws ) const
+        {
+            ws.slots.resize( m_program.size() * block_size );
+            for( size_t first = 0; first < rows; first += block_size ){
+                size_t const n = rows - first < block_size ? rows - first : block_size;
+                for( size_t i = 0; i != m_program.size(); ++i ){
+                    plan_instruction const & in = m_program[i];
+                    T *dst = &ws.slots[ i * block_size ];
+                    T const *a = &ws.slots[ in.lhs * block_size ];
+                    T const *b = &ws.slots[ in.rhs * block_size ];
+                    T const *c = &ws.slots[ in.aux * block_size ];
+                    switch( in.op ){
+                        case plan_opcode::Constant:
+                            std::fill( dst, dst + n, static_cast<T>( in.value ) ); break;
+                        case plan_opcode::Variable:
+                            std::copy( columns[ in.index ] + first, columns[ in.index ] + first + n, dst ); break;
+                        case plan_opcode::Plus:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = a[j] + b[j];
+                            break;
+                        case plan_opcode::Minus:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = a[j] - b[j];
+                            break;
+                        case plan_opcode::Multiplies:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = a[j] * b[j];
+                            break;
+                        case plan_opcode::Divides:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = a[j] / b[j];
+                            break;
+                        case plan_opcode::Sin:
+                            sin_block( a, dst, n, ws.trig );
+                            break;
+                        case plan_opcode::Cos:
+                            cos_block( a, dst, n, ws.trig );
+                            break;
+                        case plan_opcode::Square:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = a[j] * a[j];
+                            break;
+                        case plan_opcode::MultiplyAdd:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = std::fma( a[j], b[j], c[j] );
+                            break;
+                        case plan_opcode::Less:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = static_cast<T>( a[j] < b[j] );
+                            break;
+                        case plan_opcode::LessEqual:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = static_cast<T>( a[j] <= b[j] );
+                            break;
+                        case plan_opcode::Greater:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = static_cast<T>( a[j] > b[j] );
+                            break;
+                        case plan_opcode::GreaterEqual:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = static_cast<T>( a[j] >= b[j] );
+                            break;
+                        case plan_opcode::Equal:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = static_cast<T>( a[j] == b[j] );
+                            break;
+                        case plan_opcode::Min:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = std::min( a[j], b[j] );
+                            break;
+                        case plan_opcode::Max:
+                            for( size_t j = 0; j != n; ++j ) dst[j] = std::max( a[j], b[j] );
+                            break;
+                        case plan_opcode::Select:
+                            detail::select_block( a, b, c, dst, n );
+                            break;
+                    }
+                }
+                for( size_t k = 0; k != m_outputs.size(); ++k ){
+                    T const *src = &ws.slots[ m_outputs[k] * block_size ];
+                    std::copy( src, src + n, outputs[k] + first );
+                }
+            }
+        }
+
+    private:
+
+        using instruction_key = std::tuple< int, size_t, size_t, std::uint64_t, int, size_t >;
+
+        static plan_opcode opcode_for( const_expr_ptr const & e )
+        {
+            switch( e->get_type() ){
+                case Constant:                  return plan_opcode::Constant;
+                case Variable:                  return plan_opcode::Variable;
+                case Plus: case Sum:            return plan_opcode::Plus;
+                case Minus:                     return plan_opcode::Minus;
+                case Divides:                   return plan_opcode::Divides;
+                case Multiplies: case Product:  return plan_opcode::Multiplies;
+                case Min:                       return plan_opcode::Min;
+                case Max:                       return plan_opcode::Max;
+                case Select:                    return plan_opcode::Select;
+                case Comparison: {
+                    std::string const op = e->to_string();
+                    return op == "<" ? plan_opcode::Less : op == "<=" ? plan_opcode::LessEqual : op == ">" ? plan_opcode::Greater
+                         : op == ">=" ? plan_opcode::GreaterEqual : plan_opcode::Equal;
+                }
+                case UnaryFunc: default:
+                    return e->to_string() == std::string { "cos" } ? plan_opcode::Cos : plan_opcode::Sin;
+            }
+        }
+
+        size_t compile( const_expr_ptr const & e )
+        {
+            auto seen = m_visited.find( e.get() );
+            if( seen != m_visited.end() ) return seen->second;
+
+            plan_instruction in { opcode_for( e ), 0, 0, 0.0, 0, 0 };
+            if( e->get_type() == Sum || e->get_type() == Product ){
+                // n-ary nodes become the same left-to-right chain of binary instructions evaluate_expr performs
+                size_t slot = compile( e->get_children( 0 ) );
+                for( size_t i = 1; i < e->num_children(); ++i ){
+                    in.lhs = slot;
+                    in.rhs = compile( e->get_children( i ) );
+                    slot = append( in );
+                }
+                m_visited.insert( { e.get(), slot } );
+                return slot;
+            }
+            switch( in.op ){
+                case plan_opcode::Constant:
+                    in.value = e->eval();
+                    break;
+                case plan_opcode::Variable:
+                    in.index = get_variable_index( e );
+                    break;
+                case plan_opcode::Sin: case plan_opcode::Cos:
+                    in.lhs = compile( e->get_children( 0 ) );
+                    break;
+                case plan_opcode::Select:
+                    in.lhs = compile( e->get_children( 0 ) );
+                    in.rhs = compile( e->get_children( 1 ) );
+                    in.aux = compile( e->get_children( 2 ) );
+                    break;
+                default:
+                    in.lhs = compile( e->get_children( 0 ) );
+                    in.rhs = compile( e->get_children( 1 ) );
+                    break;
+            }
+            size_t const slot = append( in );
+            m_visited.insert( { e.get(), slot } );
+            return slot;
+        }
+
+        std::vector< plan_instruction > m_program;
+        std::vector< size_t > m_outputs;
+        size_t m_num_inputs = 0;
+        std::map< instruction_key, size_t > m_shared;
+        std::unordered_map< expr const *, size_t > m_visited;
+    };
+
+    // Average batch evaluation time per row in nanoseconds, in scalar type T, with every variable bound to its default value.
+    template< typename T = double >
+    inline double time_plan( evaluation_plan const & plan, size_t const & rows = 1 << 16, size_t const & repeats = 8 )
+    {
+        std::vector< double > const row = default_bindings( plan.num_inputs() );
+        std::vector< std::vector< T > > input( plan.num_inputs() ), output( plan.num_outputs(), std::vector< T >( rows ) );
+        std::vector< T const * > columns;
+        std::vector< T * > outputs;
+        for( size_t i = 0; i != input.size(); ++i ){
+            input[i].assign( rows, static_cast< T >( row[i] ) );
+            columns.push_back( input[i].data() );
+        }
+        for( auto & column : output ) outputs.push_back( column.data() );
+
+        basic_plan_workspace< T > ws {};
+        auto const start = std::chrono::steady_clock::now();
+        for( size_t r = 0; r != repeats; ++r ){
+            plan.evaluate_batch( columns.data(), rows, outputs.data(), ws );
+        }
+        std::chrono::duration< double, std::nano > const elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / ( rows * repeats );
+    }
+
+    inline evaluation_plan make_plan( std::vector< const_expr_ptr > const & roots )
+    {
+        return evaluation_plan { roots };
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_PLAN_H_INCLUDED
@@ -0,0 +1,231 @@
+#ifndef EXPRESSION_POLYNOMIAL_H_INCLUDED
+#define EXPRESSION_POLYNOMIAL_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Expression
+{
+    // coefficients[k] belongs to x^k
+    using polynomial = std::vector< double >;
+
+    struct polynomial_options
+    {
+        bool estrin = false;        // split into independent halves ( Estrin ) instead of one dependent chain ( Horner )
+        size_t max_degree = 64;     // larger polynomials are left alone
+    };
+
+    struct polynomial_report
+    {
+        size_t polynomials = 0;                 // subtrees that were rebuilt
+        size_t multiplications_before = 0;
+        size_t multiplications_after = 0;
+    };
+
+    // Multiplications a tree evaluator performs, counting shared subtrees once; an n-ary product counts n - 1.
+    inline size_t count_multiplications( const_expr_ptr const & root )
+    {
+        size_t count = 0;
+        std::unordered_set< expr const * > seen {};
+        std::vector< const_expr_ptr > pending { root };
+        while( !pending.empty() ){
+            const_expr_ptr const e = pending.back();
+            pending.pop_back();
+            if( !seen.insert( e.get() ).second ) continue;
+            if( e->get_type() == Multiplies ) ++count;
+            if( e->get_type() == Product && e->num_children() > 1 ) count += e->num_children() - 1;
+            for( size_t i = 0; i != e->num_children(); ++i ) pending.push_back( e->get_children( i ) );
+        }
+        return count;
+    }
+
+    namespace detail {
+
+    // A subtree read as a polynomial in variable ( -1 while only constants have been seen ).
+    struct polynomial_info
+    {
+        bool valid = false;
+        int variable = -1;
+        polynomial coefficients {};
+    };
+
+    inline bool same_variable( int & variable, int const & other )
+    {
+        if( other < 0 || variable == other ) return true;
+        if( variable >= 0 ) return false;
+        variable = other;
+        return true;
+    }
+
+    inline void add_into( polynomial & sum, polynomial const & p, double const & sign )
+    {
+        if( sum.size() < p.size() ) sum.resize( p.size(), 0.0 );
+        for( size_t k = 0; k != p.size(); ++k ) sum[k] += sign * p[k];
+    }
+
+    inline polynomial multiply_polynomials( polynomial const & a, polynomial const & b )
+    {
+        polynomial product( a.size() + b.size() - 1, 0.0 );
+        for( size_t i = 0; i != a.size(); ++i ){
+            for( size_t j = 0; j != b.size(); ++j ) product[ i + j ] += a[i] * b[j];
+        }
+        return product;
+    }
+
+    using polynomial_memo = std::unordered_map< expr const *, polynomial_info >;
+
+    inline polynomial_info const & analyze( const_expr_ptr const & e, polynomial_options const & options, polynomial_memo & memo )
+    {
+        auto found = memo.find( e.get() );
+        if( found != memo.end() ) return found->second;
+
+        std::vector< polynomial_info const * > children( e->num_children() );
+        for( size_t i = 0; i != children.size(); ++i ) children[i] = &analyze( e->get_children( i ), options, memo );
+
+        polynomial_info info {};
+        switch( e->get_type() ){
+            case Constant:
+                info.valid = true;
+                info.coefficients = { e->eval() };
+                break;
+            case Variable:
+                info.valid = true;
+                info.variable = get_variable_index( e );
+                info.coefficients = { 0.0, 1.0 };
+                break;
+            case Plus: case Minus: case Sum: case Multiplies: case Product: {
+                bool const multiply = e->get_type() == Multiplies || e->get_type() == Product;
+                info.valid = true;
+                info.coefficients = { multiply ? 1.0 : 0.0 };
+                for( size_t i = 0; i != children.size() && info.valid; ++i ){
+                    info.valid = children[i]->valid && same_variable( info.variable, children[i]->variable );
+                    if( !info.valid ) break;
+                    if( multiply ){
+                        info.coefficients = multiply_polynomials( info.coefficients, children[i]->coefficients );
+                    } else {
+                        add_into( info.coefficients, children[i]->coefficients, e->get_type() == Minus && i == 1 ? -1.0 : 1.0 );
+                    }
+                    info.valid = info.coefficients.size() <= options.max_degree + 1;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        if( !info.valid ) info.coefficients.clear();
+        while( info.coefficients.size() > 1 && info.coefficients.back() == 0.0 ) info.coefficients.pop_back();
+        return memo.insert( { e.get(), std::move( info ) } ).first->second;
+    }
+
+    // c * term and c + term, leaving out multiplications by one and additions of zero
+    inline expr_ptr scaled( double const & c, expr_ptr const & term )
+    {
+        return c == 1.0 ? term : make_multiplies( make_constant( c ), term );
+    }
+
+    inline expr_ptr shifted( double const & c, expr_ptr const & term )
+    {
+        return c == 0.0 ? term : make_plus( make_constant( c ), term );
+    }
+
+    // ( ( c_n * x + c_n-1 ) * x + ... ) * x + c_0
+    inline expr_ptr build_horner( polynomial const & p, expr_ptr const & x )
+    {
+        size_t k = p.size() - 1;
+        expr_ptr result = k == 0 ? make_constant( p[0] ) : scaled( p[k], x );
+        while( k-- > 0 ){
+            result = shifted( p[k], result );
+            if( k > 0 ) result = make_multiplies( result, x );
+        }
+        return result;
+    }
+
+    // p[ first, last ) as low + x^half * high, where half is a power of two and powers[j] is x^( 2^j )
+    inline expr_ptr build_estrin( polynomial const & p, size_t const & first, size_t const & last, std::vector< expr_ptr > & powers )
+    {
+        size_t const n = last - first;
+        if( n == 1 ) return make_constant( p[ first ] );
+        size_t half = 1, level = 0;
+        while( 2 * half < n ){
+            half *= 2;
+            ++level;
+        }
+        while( powers.size() <= level ) powers.push_back( make_multiplies( powers.back(), powers.back() ) );
+
+        bool zero_high = true;
+        for( size_t k = first + half; k != last; ++k ) zero_high = zero_high && p[k] == 0.0;
+        expr_ptr const low = build_estrin( p, first, first + half, powers );
+        if( zero_high ) return low;
+        expr_ptr const high = last - first - half == 1 ? nullptr : build_estrin( p, first + half, last, powers );
+        expr_ptr const term = high ? make_multiplies( high, powers[ level ] ) : scaled( p[ first + half ], powers[ level ] );
+
+        bool zero_low = true;
+        for( size_t k = first; k != first + half; ++k ) zero_low = zero_low && p[k] == 0.0;
+        return zero_low ? term : make_plus( low, term );
+    }
+
+    inline expr_ptr build_polynomial( polynomial_info const & info, polynomial_options const & options )
+    {
+        if( info.coefficients.size() == 1 || info.variable < 0 ) return make_constant( info.coefficients[0] );
+        expr_ptr const x = make_variable_with_index<>( info.variable );
+        if( !options.estrin ) return build_horner( info.coefficients, x );
+        std::vector< expr_ptr > powers { x };
+        return build_estrin( info.coefficients, 0, info.coefficients.size(), powers );
+    }
+
+    inline expr_ptr horner_impl( expr_ptr const & e, polynomial_options const & options, polynomial_memo & memo,
+                                 std::unordered_map< expr const *, expr_ptr > & done, polynomial_report & report )
+    {
+        auto found = done.find( e.get() );
+        if( found != done.end() ) return found->second;
+
+        expr_ptr result = e;
+        polynomial_info const & info = analyze( e, options, memo );
+        if( info.valid && e->num_children() != 0 ){
+            expr_ptr const rebuilt = build_polynomial( info, options );
+            if( count_multiplications( rebuilt ) < count_multiplications( e ) ){
+                ++report.polynomials;
+                result = rebuilt;
+            }
+        } else if( e->num_children() != 0 ){
+            bool changed = false;
+            std::vector< expr_ptr > children( e->num_children() );
+            for( size_t i = 0; i != children.size(); ++i ){
+                children[i] = horner_impl( e->get_children( i ), options, memo, done, report );
+                changed = changed || children[i] != e->get_children( i );
+            }
+            if( changed ) result = make_node_like( e, std::move( children ) );
+        }
+        done.insert( { e.get(), result } );
+        return result;
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: horner_form
+ * @param: expression, options, optional report
+ * @return: expression with polynomial subtrees rebuilt
+ * Every largest subtree made only of Plus, Minus, Multiplies, Sum, Product, constants and one variable is expanded
+ * into its coefficients and rebuilt in Horner form ( degree n needs n multiplications ) or, with options.estrin, in
+ * Estrin form, which needs about as many but evaluates the halves independently. A subtree is only replaced when that
+ * saves multiplications. Collecting coefficients reassociates the arithmetic, so results agree up to rounding.
+ */
+    inline expr_ptr horner_form( expr_ptr const & e, polynomial_options const & options = polynomial_options {},
+                                 polynomial_report *report = nullptr )
+    {
+        polynomial_report stats {};
+        stats.multiplications_before = count_multiplications( e );
+        detail::polynomial_memo memo {};
+        std::unordered_map< expr const *, expr_ptr > done {};
+        expr_ptr result = detail::horner_impl( e, options, memo, done, stats );
+        stats.multiplications_after = count_multiplications( result );
+        if( report ) *report = stats;
+        return result;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_POLYNOMIAL_H_INCLUDED
@@ -0,0 +1,90 @@
+#ifndef EXPRESSION_PRECISION_H_INCLUDED
+#define EXPRESSION_PRECISION_H_INCLUDED
+
+#include "expression_plan.hpp"
+#include <ostream>
+#include <limits>
+
+namespace Expression
+{
+    struct precision_report
+    {
+        size_t rows = 0;
+        double max_abs_error = 0.0;
+        double max_rel_error = 0.0;
+        double mean_rel_error = 0.0;
+        double ns_per_row_double = 0.0;
+        double ns_per_row_float = 0.0;
+
+        double speedup( void ) const { return ns_per_row_float > 0.0 ? ns_per_row_double / ns_per_row_float : 0.0; }
+    };
+
+/*
+ *
+ * name: compare_precision
+ * @param: plan, number of rows
+ * @return: precision_report
+ * Evaluates the plan over the same batch once in double and once entirely in float and reports the error of the
+ * float results relative to the double ones, together with the batch throughput of both. Row r binds var<i> to its
+ * default value scaled by 1 + r / rows, so the inputs cover a range instead of a single point.
+ */
+    inline precision_report compare_precision( evaluation_plan const & plan, size_t const & rows = 1 << 14 )
+    {
+        std::vector< double > const row = default_bindings( plan.num_inputs() );
+        std::vector< std::vector< double > > input_d( plan.num_inputs() ), output_d( plan.num_outputs(), std::vector< double >( rows ) );
+        std::vector< std::vector< float > > input_f( plan.num_inputs() ), output_f( plan.num_outputs(), std::vector< float >( rows ) );
+        std::vector< double const * > columns_d;
+        std::vector< float const * > columns_f;
+        std::vector< double * > outputs_d;
+        std::vector< float * > outputs_f;
+
+        for( size_t i = 0; i != plan.num_inputs(); ++i ){
+            input_d[i].resize( rows );
+            input_f[i].resize( rows );
+            for( size_t r = 0; r != rows; ++r ){
+                input_d[i][r] = row[i] * ( 1.0 + static_cast< double >( r ) / rows );
+                input_f[i][r] = static_cast< float >( input_d[i][r] );
+            }
+            columns_d.push_back( input_d[i].data() );
+            columns_f.push_back( input_f[i].data() );
+        }
+        for( auto & column : output_d ) outputs_d.push_back( column.data() );
+        for( auto & column : output_f ) outputs_f.push_back( column.data() );
+
+        basic_plan_workspace< double > ws_d {};
+        basic_plan_workspace< float > ws_f {};
+        plan.evaluate_batch( columns_d.data(), rows, outputs_d.data(), ws_d );
+        plan.evaluate_batch( columns_f.data(), rows, outputs_f.data(), ws_f );
+
+        precision_report report {};
+        report.rows = rows;
+        double sum_rel = 0.0;
+        size_t counted = 0;
+        for( size_t k = 0; k != plan.num_outputs(); ++k ){
+            for( size_t r = 0; r != rows; ++r ){
+                double const exact = output_d[k][r];
+                double const error = std::fabs( static_cast< double >( output_f[k][r] ) - exact );
+                double const scale = std::max( std::fabs( exact ), std::numeric_limits< double >::min() );
+                report.max_abs_error = std::max( report.max_abs_error, error );
+                report.max_rel_error = std::max( report.max_rel_error, error / scale );
+                sum_rel += error / scale;
+                ++counted;
+            }
+        }
+        report.mean_rel_error = counted ? sum_rel / counted : 0.0;
+        report.ns_per_row_double = time_plan< double >( plan, rows );
+        report.ns_per_row_float = time_plan< float >( plan, rows );
+        return report;
+    }
+
+    inline std::ostream & operator<<( std::ostream & out, precision_report const & report )
+    {
+        out << "float vs double over " << report.rows << " rows: max abs error " << report.max_abs_error
+            << ", max rel error " << report.max_rel_error << ", mean rel error " << report.mean_rel_error
+            << "; " << report.ns_per_row_double << " -> " << report.ns_per_row_float << " ns/row ( x"
+            << report.speedup() << " )\n";
+        return out;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_PRECISION_H_INCLUDED
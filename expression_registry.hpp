@@ -0,0 +1,291 @@
+#ifndef EXPRESSION_REGISTRY_H_INCLUDED
+#define EXPRESSION_REGISTRY_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+#include <ostream>
+
+namespace Expression
+{
+/*
+ *
+ * name: expression_registry
+ * Named expressions shared between many evaluating threads and a few updating ones, read-copy-update style.
+ * The whole table is an immutable snapshot behind one atomic pointer. A writer copies it, changes the copy and
+ * publishes it with a single store, so a reader sees either all or none of an update ( publish_all changes
+ * several names at once ). Readers go through a reader handle, which announces the current epoch in a slot of its
+ * own while it looks at the table: a read is two stores and two loads, with no lock, no retry and no shared write.
+ * A replaced table is retired with the epoch of its replacement and freed once no announced epoch is older, so
+ * it outlives every read that could still see it. Trees are handed out as const_expr_ptr and live as long as
+ * anyone holds them.
+ */
+    class expression_registry
+    {
+        struct table
+        {
+            std::vector< const_expr_ptr > trees;  // indexed by id, nullptr once removed
+        };
+
+        struct reader_slot
+        {
+            std::atomic< bool > in_use;
+            std::atomic< std::uint64_t > epoch;   // 0 while the owner is not reading
+            char padding[ 64 - sizeof( std::atomic< bool > ) - sizeof( std::atomic< std::uint64_t > ) ];
+        };
+
+        struct retired_table
+        {
+            table const *tree_table;
+            std::uint64_t epoch;
+        };
+
+    public:
+        static constexpr size_t npos = static_cast< size_t >( -1 );
+
+        class reader
+        {
+        public:
+            reader( reader && other ) : m_registry{ other.m_registry }, m_slot{ other.m_slot } { other.m_slot = nullptr; }
+            reader( reader const & ) = delete;
+            reader & operator=( reader const & ) = delete;
+            ~reader() { if( m_slot ) m_slot->in_use.store( false, std::memory_order_release ); }
+
+            // The tree published under id, or nullptr. The returned pointer keeps the tree alive on its own.
+            const_expr_ptr get( size_t const & id ) const
+            {
+                return read( id, []( const_expr_ptr const & e ){ return e; } );
+            }
+
+            // Calls f( tree ) inside the read section, which avoids touching the tree's reference count.
+            template< typename F >
+            auto read( size_t const & id, F f ) const -> decltype( f( std::declval< const_expr_ptr const & >() ) )
+            {
+                return read_all( [&]( std::vector< const_expr_ptr > const & trees ){
+                    static const_expr_ptr const none {};
+                    return f( id < trees.size() ? trees[ id ] : none );
+                } );
+            }
+
+            // Calls f( trees ), indexed by id, inside one read section, so all of them belong to the same version.
+            template< typename F >
+            auto read_all( F f ) const -> decltype( f( std::declval< std::vector< const_expr_ptr > const & >() ) )
+            {
+                section guard { *m_slot, m_registry->m_epoch };
+                return f( m_registry->m_table.load( std::memory_order_seq_cst )->trees );
+            }
+
+        private:
+            friend class expression_registry;
+
+            struct section
+            {
+                section( reader_slot & slot, std::atomic< std::uint64_t > const & epoch ) : m_slot( slot )
+                {
+                    m_slot.epoch.store( epoch.load( std::memory_order_seq_cst ), std::memory_order_seq_cst );
+                }
+                ~section() { m_slot.epoch.store( 0, std::memory_order_release ); }
+                reader_slot & m_slot;
+            };
+
+            reader( expression_registry const *registry, reader_slot *slot ) : m_registry{ registry }, m_slot{ slot } { }
+
+            expression_registry const *m_registry;
+            reader_slot *m_slot;
+        };
+
+        explicit expression_registry( size_t const & max_readers = 256 )
+        : m_slots( new reader_slot[ max_readers ] ), m_max_readers{ max_readers }, m_table{ new table {} }, m_epoch{ 1 },
+          m_writer{}, m_ids{}, m_retired{}, m_reclaimed{ 0 }
+        {
+            for( size_t i = 0; i != max_readers; ++i ){
+                m_slots[i].in_use.store( false );
+                m_slots[i].epoch.store( 0 );
+            }
+        }
+        expression_registry( expression_registry const & ) = delete;
+        expression_registry & operator=( expression_registry const & ) = delete;
+
+        // No reader may be alive any more.
+        ~expression_registry()
+        {
+            for( auto const & r : m_retired ) delete r.tree_table;
+            delete m_table.load();
+        }
+
+        // Each reading thread takes one handle and keeps it; throws when all max_readers slots are taken.
+        reader make_reader( void ) const
+        {
+            for( size_t i = 0; i != m_max_readers; ++i ){
+                bool expected = false;
+                if( m_slots[i].in_use.compare_exchange_strong( expected, true, std::memory_order_acq_rel ) ) return reader { this, &m_slots[i] };
+            }
+            throw std::runtime_error( "expression_registry: no free reader slot" );
+        }
+
+        // Ids are assigned on first publish and stay valid, so readers can resolve names once.
+        size_t id( std::string const & name ) const
+        {
+            std::lock_guard< std::mutex > lock { m_writer };
+            auto found = m_ids.find( name );
+            return found == m_ids.end() ? npos : found->second;
+        }
+
+        size_t publish( std::string const & name, const_expr_ptr tree )
+        {
+            std::vector< std::pair< std::string, const_expr_ptr > > update { { name, std::move( tree ) } };
+            return publish_all( update ).front();
+        }
+
+        // Publishes every ( name, tree ) pair as one new version; a nullptr tree removes the name's tree.
+        std::vector< size_t > publish_all( std::vector< std::pair< std::string, const_expr_ptr > > const & updates )
+        {
+            std::lock_guard< std::mutex > lock { m_writer };
+            table *next = new table( *m_table.load( std::memory_order_relaxed ) );
+            std::vector< size_t > ids {};
+            for( auto const & u : updates ){
+                auto found = m_ids.insert( { u.first, m_ids.size() } ).first;
+                if( next->trees.size() <= found->second ) next->trees.resize( found->second + 1 );
+                next->trees[ found->second ] = u.second;
+                ids.push_back( found->second );
+            }
+            table const *previous = m_table.exchange( next, std::memory_order_seq_cst );
+            m_retired.push_back( retired_table { previous, m_epoch.fetch_add( 1, std::memory_order_seq_cst ) + 1 } );
+            reclaim_locked();
+            return ids;
+        }
+
+        void remove( std::string const & name ) { publish_all( { { name, nullptr } } ); }
+
+        // Frees the retired tables no reader can see any more; publish does this too.
+        void reclaim( void )
+        {
+            std::lock_guard< std::mutex > lock { m_writer };
+            reclaim_locked();
+        }
+
+        size_t retired( void ) const { std::lock_guard< std::mutex > lock { m_writer }; return m_retired.size(); }
+        size_t reclaimed( void ) const { std::lock_guard< std::mutex > lock { m_writer }; return m_reclaimed; }
+
+    private:
+
+        void reclaim_locked( void )
+        {
+            std::uint64_t oldest = m_epoch.load( std::memory_order_seq_cst );
+            for( size_t i = 0; i != m_max_readers; ++i ){
+                std::uint64_t const announced = m_slots[i].epoch.load( std::memory_order_seq_cst );
+                if( announced != 0 && announced < oldest ) oldest = announced;
+            }
+            size_t kept = 0;
+            for( auto const & r : m_retired ){
+                if( r.epoch <= oldest ){
+                    delete r.tree_table;
+                    ++m_reclaimed;
+                } else {
+                    m_retired[ kept++ ] = r;
+                }
+            }
+            m_retired.resize( kept );
+        }
+
+        std::unique_ptr< reader_slot[] > m_slots;
+        size_t m_max_readers;
+        std::atomic< table const * > m_table;
+        alignas( 64 ) std::atomic< std::uint64_t > m_epoch;
+        mutable std::mutex m_writer;
+        std::unordered_map< std::string, size_t > m_ids;
+        std::vector< retired_table > m_retired;
+        size_t m_reclaimed;
+    };
+
+    struct registry_benchmark
+    {
+        size_t readers = 0;
+        double seconds = 0.0;
+        size_t reads = 0;
+        size_t publishes = 0;
+        size_t reclaimed = 0;
+        size_t violations = 0;      // reads that went back to an older version, must stay 0
+
+        double reads_per_second( void ) const { return seconds > 0.0 ? reads / seconds : 0.0; }
+    };
+
+/*
+ *
+ * name: stress_registry
+ * @param: reader threads, duration
+ * @return: read throughput while one writer keeps publishing
+ * Stress test and benchmark in one: the writer publishes "x" and "y" together as the constants n and -n for
+ * n = 1, 2, ... while the readers evaluate both. Every read pair must sum to zero ( publish_all is atomic ) and
+ * no reader may see n decrease.
+ */
+    inline registry_benchmark stress_registry( size_t const & readers = std::thread::hardware_concurrency(),
+                                               std::chrono::milliseconds const & duration = std::chrono::milliseconds( 200 ) )
+    {
+        expression_registry registry {};
+        registry.publish_all( { { "x", make_constant( 0.0 ) }, { "y", make_constant( 0.0 ) } } );
+        size_t const x = registry.id( "x" ), y = registry.id( "y" );
+
+        registry_benchmark result {};
+        result.readers = readers ? readers : 1;
+        std::atomic< bool > stop { false };
+        std::atomic< size_t > reads { 0 }, violations { 0 };
+        std::vector< std::thread > threads {};
+        for( size_t t = 0; t != result.readers; ++t ){
+            threads.emplace_back( [&]{
+                expression_registry::reader handle = registry.make_reader();
+                size_t local_reads = 0, local_violations = 0;
+                double last = 0.0;
+                while( !stop.load( std::memory_order_relaxed ) ){
+                    double vx = 0.0, vy = 0.0;
+                    handle.read_all( [&]( std::vector< const_expr_ptr > const & trees ){
+                        vx = evaluate_expr( trees[x] );
+                        vy = evaluate_expr( trees[y] );
+                    } );
+                    if( vx < last || vx + vy != 0.0 ) ++local_violations;
+                    last = vx;
+                    local_reads += 2;
+                }
+                reads += local_reads;
+                violations += local_violations;
+            } );
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        double n = 0.0;
+        while( std::chrono::steady_clock::now() - start < duration ){
+            n += 1.0;
+            registry.publish_all( { { "x", make_constant( n ) }, { "y", make_constant( -n ) } } );
+            ++result.publishes;
+            std::this_thread::yield();
+        }
+        stop = true;
+        for( auto & thread : threads ) thread.join();
+        std::chrono::duration< double > const elapsed = std::chrono::steady_clock::now() - start;
+        registry.reclaim();
+
+        result.seconds = elapsed.count();
+        result.reads = reads.load();
+        result.violations = violations.load();
+        result.reclaimed = registry.reclaimed();
+        return result;
+    }
+
+    inline std::ostream & operator<<( std::ostream & os, registry_benchmark const & r )
+    {
+        os << r.readers << " readers: " << r.reads_per_second() << " reads/s during " << r.publishes << " publishes, "
+           << r.reclaimed << " tables reclaimed, " << r.violations << " violations\n";
+        return os;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_REGISTRY_H_INCLUDED
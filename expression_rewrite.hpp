@@ -0,0 +1,370 @@
+#ifndef EXPRESSION_REWRITE_H_INCLUDED
+#define EXPRESSION_REWRITE_H_INCLUDED
+
+#include "expression_io.hpp"
+#include "expression_hash.hpp"
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+namespace Expression
+{
+    /*
+     * A pattern is either a capture wildcard, which matches any subtree, or a node pattern restricted by type and,
+     * optionally, by function name, constant value or variable index. Node patterns can carry a capture id too, so
+     * a rule can read the constant or variable it matched. Using the same capture id twice requires both subtrees
+     * to be structurally equal.
+     */
+    struct pattern
+    {
+        bool wildcard = true;
+        int capture = -1;
+        expression_type type = None;
+        std::string function {};
+        bool has_value = false;
+        double value = 0.0;
+        int index = -1;
+        std::vector< pattern > children {};
+    };
+
+    inline pattern pattern_any( int const & capture )
+    {
+        pattern p {};
+        p.capture = capture;
+        return p;
+    }
+
+    inline pattern pattern_node( expression_type const & type, std::vector< pattern > children = {} )
+    {
+        pattern p {};
+        p.wildcard = false;
+        p.type = type;
+        p.children = std::move( children );
+        return p;
+    }
+
+    inline pattern pattern_function( std::string const & name, pattern child )
+    {
+        pattern p = pattern_node( UnaryFunc, { std::move( child ) } );
+        p.function = name;
+        return p;
+    }
+
+    inline pattern pattern_constant( void ) { return pattern_node( Constant ); }
+    inline pattern pattern_constant( double const & value )
+    {
+        pattern p = pattern_node( Constant );
+        p.has_value = true;
+        p.value = value;
+        return p;
+    }
+
+    inline pattern pattern_variable( int const & index = -1 )
+    {
+        pattern p = pattern_node( Variable );
+        p.index = index;
+        return p;
+    }
+
+    inline pattern pattern_bind( int const & capture, pattern p )
+    {
+        p.capture = capture;
+        return p;
+    }
+
+    struct rewrite_match
+    {
+        std::vector< expr_ptr > captures;
+
+        expr_ptr operator[]( size_t const & i ) const { return i < captures.size() ? captures[i] : nullptr; }
+    };
+
+    // rhs may return nullptr to decline a match, which lets a rule add conditions the pattern cannot express.
+    struct rewrite_rule
+    {
+        std::string name;
+        pattern lhs;
+        std::function< expr_ptr( rewrite_match const & ) > rhs;
+    };
+
+    /*
+     * innermost normalizes the children before trying the rules at a node; outermost applies the rules at a node
+     * until none fires and only then descends, which suits rules that move work down one spine, such as reassociation.
+     */
+    enum class rewrite_order
+    {
+        innermost,
+        outermost
+    };
+
+    struct rewrite_report
+    {
+        size_t nodes_visited = 0;
+        size_t match_attempts = 0;
+        size_t rewrites = 0;
+        std::vector< size_t > rewrites_per_rule;
+    };
+
+    namespace detail {
+
+    inline std::string value_symbol( double const & value )
+    {
+        std::uint64_t bits = 0;
+        std::memcpy( &bits, &value, sizeof( bits ) );
+        return std::to_string( bits );
+    }
+
+    // Symbol of a node pattern in the discrimination tree; "*" stands for a capture wildcard.
+    inline std::string pattern_symbol( pattern const & p )
+    {
+        if( p.wildcard ) return "*";
+        std::string symbol = std::to_string( static_cast< int >( p.type ) ) + "/" + std::to_string( p.children.size() );
+        if( p.type == Constant && p.has_value ) symbol += "=" + value_symbol( p.value );
+        if( p.type == Variable && p.index >= 0 ) symbol += "#" + std::to_string( p.index );
+        if( ( p.type == UnaryFunc || p.type == Comparison ) && !p.function.empty() ) symbol += ":" + p.function;
+        return symbol;
+    }
+
+    // The generic and, where there is one, the specific symbol a subject node can be matched by.
+    inline void node_symbols( const_expr_ptr const & e, std::string ( & symbols )[2], size_t & count )
+    {
+        symbols[0] = std::to_string( static_cast< int >( e->get_type() ) ) + "/" + std::to_string( e->num_children() );
+        count = 1;
+        switch( e->get_type() ){
+            case Constant:  symbols[ count++ ] = symbols[0] + "=" + value_symbol( e->eval() ); break;
+            case Variable:  symbols[ count++ ] = symbols[0] + "#" + std::to_string( get_variable_index( e ) ); break;
+            case UnaryFunc: case Comparison: symbols[ count++ ] = symbols[0] + ":" + e->to_string(); break;
+            default: break;
+        }
+    }
+
+    inline bool bind_pattern( pattern const & p, expr_ptr const & e, rewrite_match & m )
+    {
+        if( !p.wildcard ){
+            if( e->get_type() != p.type || e->num_children() != p.children.size() ) return false;
+            if( p.type == Constant && p.has_value && e->eval() != p.value ) return false;
+            if( p.type == Variable && p.index >= 0 && get_variable_index( e ) != p.index ) return false;
+            if( ( p.type == UnaryFunc || p.type == Comparison ) && !p.function.empty() && e->to_string() != p.function ) return false;
+            for( size_t i = 0; i != p.children.size(); ++i ){
+                if( !bind_pattern( p.children[i], e->get_children( i ), m ) ) return false;
+            }
+        }
+        if( p.capture >= 0 ){
+            size_t const id = static_cast< size_t >( p.capture );
+            if( m.captures.size() <= id ) m.captures.resize( id + 1 );
+            if( m.captures[id] ) return structurally_equal( m.captures[id], e );
+            m.captures[id] = e;
+        }
+        return true;
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: rule_set
+ * Rules are compiled into a discrimination tree: a trie over the preorder symbol sequence of every left-hand side,
+ * with wildcards skipping a whole subtree. Matching walks the trie once per subject node and yields exactly the
+ * rules whose shape fits, instead of trying every rule in turn; captures and repeated-capture equality are checked
+ * only for those. When several rules fit, the one added first wins.
+ */
+    class rule_set
+    {
+        struct trie_node
+        {
+            std::map< std::string, size_t > next;
+            std::vector< size_t > rules;
+        };
+
+    public:
+        explicit rule_set( rewrite_order const & order = rewrite_order::innermost ) : m_rules{}, m_trie( 1 ), m_order( order ) { }
+
+        rule_set & add( rewrite_rule rule )
+        {
+            std::vector< pattern const * > pending { &rule.lhs };
+            size_t state = 0;
+            while( !pending.empty() ){
+                pattern const *p = pending.back();
+                pending.pop_back();
+                std::string const symbol = detail::pattern_symbol( *p );
+                auto found = m_trie[state].next.find( symbol );
+                if( found == m_trie[state].next.end() ){
+                    m_trie.push_back( trie_node {} );
+                    found = m_trie[state].next.insert( { symbol, m_trie.size() - 1 } ).first;
+                }
+                state = found->second;
+                if( !p->wildcard ){
+                    for( size_t i = p->children.size(); i-- > 0; ) pending.push_back( &p->children[i] );
+                }
+            }
+            m_trie[state].rules.push_back( m_rules.size() );
+            m_rules.push_back( std::move( rule ) );
+            return *this;
+        }
+
+        size_t size( void ) const { return m_rules.size(); }
+        rewrite_order order( void ) const { return m_order; }
+        rewrite_rule const & operator[]( size_t const & i ) const { return m_rules[i]; }
+
+        // Indices of the rules whose shape matches e, in the order they were added.
+        std::vector< size_t > candidates( const_expr_ptr const & e ) const
+        {
+            std::vector< size_t > found {};
+            std::vector< const_expr_ptr > pending { e };
+            collect( 0, pending, found );
+            std::sort( found.begin(), found.end() );
+            found.erase( std::unique( found.begin(), found.end() ), found.end() );
+            return found;
+        }
+
+        // Tries every fitting rule at e; returns the replacement of the first that fires, or nullptr.
+        expr_ptr apply_once( expr_ptr const & e, rewrite_report *report = nullptr ) const
+        {
+            for( auto const & r : candidates( e ) ){
+                if( report ) ++report->match_attempts;
+                rewrite_match m {};
+                if( !detail::bind_pattern( m_rules[r].lhs, e, m ) ) continue;
+                expr_ptr result = m_rules[r].rhs( m );
+                if( !result ) continue;
+                if( report ){
+                    ++report->rewrites;
+                    report->rewrites_per_rule.resize( m_rules.size() );
+                    ++report->rewrites_per_rule[r];
+                }
+                return result;
+            }
+            return nullptr;
+        }
+
+    private:
+
+        void collect( size_t const & state, std::vector< const_expr_ptr > & pending, std::vector< size_t > & found ) const
+        {
+            if( pending.empty() ){
+                found.insert( found.end(), m_trie[state].rules.begin(), m_trie[state].rules.end() );
+                return;
+            }
+            const_expr_ptr const e = pending.back();
+            pending.pop_back();
+
+            auto wildcard = m_trie[state].next.find( "*" );
+            if( wildcard != m_trie[state].next.end() ) collect( wildcard->second, pending, found );
+
+            std::string symbols[2];
+            size_t count = 0;
+            detail::node_symbols( e, symbols, count );
+            for( size_t s = 0; s != count; ++s ){
+                auto edge = m_trie[state].next.find( symbols[s] );
+                if( edge == m_trie[state].next.end() ) continue;
+                for( size_t i = e->num_children(); i-- > 0; ) pending.push_back( e->get_children( i ) );
+                collect( edge->second, pending, found );
+                pending.resize( pending.size() - e->num_children() );
+            }
+            pending.push_back( e );
+        }
+
+        std::vector< rewrite_rule > m_rules;
+        std::vector< trie_node > m_trie;
+        rewrite_order m_order;
+    };
+
+    namespace detail {
+
+    // Keyed by owning pointer: replacements are temporaries, and a freed one must not hand its address to a new node.
+    using rewrite_memo = std::unordered_map< expr_ptr, expr_ptr >;
+
+    inline expr_ptr rewrite_impl( expr_ptr const & e, rule_set const & rules, rewrite_report & report,
+                                  rewrite_memo & done, size_t const & budget )
+    {
+        auto found = done.find( e );
+        if( found != done.end() ) return found->second;
+        ++report.nodes_visited;
+
+        expr_ptr current = e;
+        bool changed = false;
+        std::vector< expr_ptr > children( e->num_children() );
+        for( size_t i = 0; i != children.size(); ++i ){
+            children[i] = rewrite_impl( e->get_children( i ), rules, report, done, budget );
+            changed = changed || children[i] != e->get_children( i );
+        }
+        if( changed ) current = make_node_like( e, std::move( children ) );
+
+        expr_ptr replacement = report.rewrites < budget ? rules.apply_once( current, &report ) : nullptr;
+        if( replacement ) current = rewrite_impl( replacement, rules, report, done, budget );
+
+        done.insert( { e, current } );
+        done.insert( { current, current } );
+        return current;
+    }
+
+    inline expr_ptr rewrite_outermost( expr_ptr const & e, rule_set const & rules, rewrite_report & report,
+                                       rewrite_memo & done, size_t const & budget )
+    {
+        auto found = done.find( e );
+        if( found != done.end() ) return found->second;
+        ++report.nodes_visited;
+
+        expr_ptr current = e;
+        for( ; ; ){
+            while( report.rewrites < budget ){
+                expr_ptr replacement = rules.apply_once( current, &report );
+                if( !replacement ) break;
+                current = replacement;
+            }
+            bool changed = false;
+            std::vector< expr_ptr > children( current->num_children() );
+            for( size_t i = 0; i != children.size(); ++i ){
+                children[i] = rewrite_outermost( current->get_children( i ), rules, report, done, budget );
+                changed = changed || children[i] != current->get_children( i );
+            }
+            if( !changed ) break;
+            current = make_node_like( current, std::move( children ) );
+        }
+
+        done.insert( { e, current } );
+        done.insert( { current, current } );
+        return current;
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: rewrite
+ * @param: expression, rules, optional report, rewrite budget
+ * @return: rewritten expression
+ * Rewriting to a fixpoint, in the order of the rule set. Innermost: children are normalized first, then the first
+ * fitting rule is applied at the node and the result is normalized again. Outermost: rules are applied at the node
+ * until none fits, then the children are rewritten, and the node is tried again if they changed. Either way no rule
+ * fires anywhere in the result. The input is not modified and unchanged subtrees are shared. The budget bounds the
+ * total number of rewrites for rule sets that do not terminate.
+ */
+    inline expr_ptr rewrite( expr_ptr const & e, rule_set const & rules, rewrite_report *report = nullptr,
+                             size_t const & budget = static_cast< size_t >( -1 ) )
+    {
+        rewrite_report stats {};
+        stats.rewrites_per_rule.resize( rules.size() );
+        detail::rewrite_memo done {};
+        expr_ptr result = rules.order() == rewrite_order::outermost ? detail::rewrite_outermost( e, rules, stats, done, budget )
+                                                                   : detail::rewrite_impl( e, rules, stats, done, budget );
+        if( report ) *report = stats;
+        return result;
+    }
+
+    // linearize() as a rule: ( a + b ) + c -> a + ( b + c ), which at the fixpoint leaves right-leaning Plus chains.
+    // Applied outermost, a left-leaning chain of n terms is rotated n - 2 times at its root and each new node is then
+    // visited once; innermost would re-associate the whole right spine after every rotation.
+    inline rule_set linearize_rules( void )
+    {
+        rule_set rules { rewrite_order::outermost };
+        rules.add( rewrite_rule { "plus-right-associate", pattern_node( Plus, { pattern_node( Plus, { pattern_any( 0 ), pattern_any( 1 ) } ), pattern_any( 2 ) } ),
+            []( rewrite_match const & m ){ return make_plus( m[0], make_plus( m[1], m[2] ) ); } } );
+        return rules;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_REWRITE_H_INCLUDED
@@ -0,0 +1,214 @@
+#ifndef EXPRESSION_SHAPES_H_INCLUDED
+#define EXPRESSION_SHAPES_H_INCLUDED
+
+#include "expression_plan.hpp"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+
+namespace Expression
+{
+    namespace detail {
+
+    // Appends the signature of e and collects its constant and variable leaves in preorder.
+    inline void shape_impl( const_expr_ptr const & e, std::string & signature, std::vector< const_expr_ptr > & leaves )
+    {
+        switch( e->get_type() ){
+            case Constant:  signature += 'c'; leaves.push_back( e ); return;
+            case Variable:  signature += 'v'; leaves.push_back( e ); return;
+            case UnaryFunc: signature += e->to_string(); break;
+            case Sum: case Product: signature += e->to_string() + std::to_string( e->num_children() ); break;
+            default:        signature += e->to_string(); break;
+        }
+        signature += '(';
+        for( size_t i = 0; i != e->num_children(); ++i ){
+            if( i ) signature += ',';
+            shape_impl( e->get_children( i ), signature, leaves );
+        }
+        signature += ')';
+    }
+
+    // e with its k-th leaf replaced by parameter k, read as input column k of the kernel.
+    inline expr_ptr shape_template( const_expr_ptr const & e, int & next_leaf )
+    {
+        if( e->get_type() == Constant || e->get_type() == Variable ) return make_variable_with_index<>( next_leaf++ );
+        std::vector< expr_ptr > children( e->num_children() );
+        for( size_t i = 0; i != children.size(); ++i ) children[i] = shape_template( e->get_children( i ), next_leaf );
+        return make_node_like( e, std::move( children ) );
+    }
+
+    } // namespace detail
+
+    // Structure of e with constants written as c and variables as v, e.g. "+(sin(v),c)" for sin( var0 ) + 2.
+    inline std::string shape_signature( const_expr_ptr const & e )
+    {
+        std::string signature {};
+        std::vector< const_expr_ptr > leaves {};
+        detail::shape_impl( e, signature, leaves );
+        return signature;
+    }
+
+/*
+ *
+ * name: shape_group
+ * All expressions of one shape. Leaf k of the shape is a column: constant_columns[k] holds the constant of every
+ * member, or variable_columns[k] the variable index when the leaf is a variable. kernel is an evaluation_plan of the
+ * shape whose input k is leaf k, so a row of the kernel is one member of the group.
+ */
+    struct shape_group
+    {
+        std::string signature;
+        evaluation_plan kernel;
+        std::vector< bool > is_constant;
+        std::vector< std::vector< double > > constant_columns;
+        std::vector< std::vector< int > > variable_columns;
+        std::vector< size_t > members;  // positions in the expression list
+    };
+
+    struct shape_workspace
+    {
+        plan_workspace plan;
+        std::vector< std::vector< double > > gathered;
+        std::vector< double > results;
+    };
+
+/*
+ *
+ * name: shape_batch
+ * Groups expressions by shape_signature and evaluates each group with one batch run of its kernel: variable leaves
+ * are gathered from the bindings into columns, constant leaves already are columns, and evaluate_batch then runs
+ * every instruction over the whole group block by block, instead of one tree walk per expression. The operations
+ * are those of evaluate_expr, so the results are identical.
+ */
+    class shape_batch
+    {
+    public:
+        explicit shape_batch( std::vector< const_expr_ptr > const & expressions ) : m_groups{}, m_size{ expressions.size() }, m_num_inputs{ 0 }
+        {
+            std::unordered_map< std::string, size_t > index {};
+            std::vector< const_expr_ptr > leaves {};
+            for( size_t i = 0; i != expressions.size(); ++i ){
+                std::string signature {};
+                leaves.clear();
+                detail::shape_impl( expressions[i], signature, leaves );
+                auto found = index.find( signature );
+                if( found == index.end() ){
+                    found = index.insert( { signature, m_groups.size() } ).first;
+                    m_groups.push_back( make_group( expressions[i], signature, leaves ) );
+                }
+                shape_group & group = m_groups[ found->second ];
+                for( size_t k = 0; k != leaves.size(); ++k ){
+                    if( group.is_constant[k] ){
+                        group.constant_columns[k].push_back( leaves[k]->eval() );
+                    } else {
+                        int const variable = get_variable_index( leaves[k] );
+                        group.variable_columns[k].push_back( variable );
+                        m_num_inputs = std::max( m_num_inputs, static_cast< size_t >( variable ) + 1 );
+                    }
+                }
+                group.members.push_back( i );
+            }
+        }
+
+        size_t size( void ) const { return m_size; }
+        size_t num_inputs( void ) const { return m_num_inputs; }
+        size_t num_shapes( void ) const { return m_groups.size(); }
+        std::vector< shape_group > const & groups( void ) const { return m_groups; }
+
+        // row[i] is the value of var<i>, out[j] receives the value of expression j
+        void evaluate( double const *row, double *out, shape_workspace & ws ) const
+        {
+            std::vector< double const * > columns {};
+            for( auto const & group : m_groups ){
+                size_t const n = group.members.size();
+                size_t const leaves = group.is_constant.size();
+                if( ws.gathered.size() < leaves ) ws.gathered.resize( leaves );
+                columns.resize( leaves );
+                for( size_t k = 0; k != leaves; ++k ){
+                    if( group.is_constant[k] ){
+                        columns[k] = group.constant_columns[k].data();
+                        continue;
+                    }
+                    std::vector< double > & column = ws.gathered[k];
+                    column.resize( n );
+                    int const *variables = group.variable_columns[k].data();
+                    for( size_t j = 0; j != n; ++j ) column[j] = row[ variables[j] ];
+                    columns[k] = column.data();
+                }
+                ws.results.resize( n );
+                double *result = ws.results.data();
+                group.kernel.evaluate_batch( columns.data(), n, &result, ws.plan );
+                for( size_t j = 0; j != n; ++j ) out[ group.members[j] ] = result[j];
+            }
+        }
+
+        std::vector< double > evaluate( std::vector< double > const & row ) const
+        {
+            assert( row.size() >= m_num_inputs );
+            std::vector< double > out( m_size );
+            shape_workspace ws {};
+            evaluate( row.data(), out.data(), ws );
+            return out;
+        }
+
+        // with every variable bound to its context_expr_eval value, like evaluate_expr
+        std::vector< double > evaluate( void ) const { return evaluate( default_bindings( m_num_inputs ) ); }
+
+    private:
+
+        static shape_group make_group( const_expr_ptr const & e, std::string const & signature, std::vector< const_expr_ptr > const & leaves )
+        {
+            shape_group group {};
+            group.signature = signature;
+            int next_leaf = 0;
+            group.kernel.add_root( detail::shape_template( e, next_leaf ) );
+            group.is_constant.resize( leaves.size() );
+            group.constant_columns.resize( leaves.size() );
+            group.variable_columns.resize( leaves.size() );
+            for( size_t k = 0; k != leaves.size(); ++k ) group.is_constant[k] = leaves[k]->get_type() == Constant;
+            return group;
+        }
+
+        std::vector< shape_group > m_groups;
+        size_t m_size;
+        size_t m_num_inputs;
+    };
+
+    struct shape_timing
+    {
+        size_t expressions = 0;
+        size_t shapes = 0;
+        double tree_ns = 0.0;       // per expression, one evaluate_expr each
+        double grouped_ns = 0.0;    // per expression, shape_batch::evaluate
+        bool identical = false;
+    };
+
+    inline shape_timing time_shapes( std::vector< const_expr_ptr > const & expressions, size_t const & repeats = 8 )
+    {
+        using clock = std::chrono::steady_clock;
+        shape_batch const batch { expressions };
+        std::vector< double > const row = default_bindings( batch.num_inputs() );
+        std::vector< double > tree( expressions.size() ), grouped( expressions.size() );
+        shape_workspace ws {};
+
+        auto const start = clock::now();
+        for( size_t r = 0; r != repeats; ++r ){
+            for( size_t i = 0; i != expressions.size(); ++i ) tree[i] = evaluate_expr( expressions[i] );
+        }
+        auto const middle = clock::now();
+        for( size_t r = 0; r != repeats; ++r ) batch.evaluate( row.data(), grouped.data(), ws );
+        auto const stop = clock::now();
+
+        shape_timing result {};
+        result.expressions = expressions.size();
+        result.shapes = batch.num_shapes();
+        double const count = static_cast< double >( repeats * ( expressions.empty() ? 1 : expressions.size() ) );
+        result.tree_ns = std::chrono::duration< double, std::nano >( middle - start ).count() / count;
+        result.grouped_ns = std::chrono::duration< double, std::nano >( stop - middle ).count() / count;
+        result.identical = tree == grouped;
+        return result;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_SHAPES_H_INCLUDED
@@ -0,0 +1,81 @@
+#ifndef EXPRESSION_SPECIALIZE_H_INCLUDED
+#define EXPRESSION_SPECIALIZE_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+namespace Expression
+{
+    using variable_bindings = std::map< int, double >;
+
+    namespace detail {
+
+    inline double fold( const_expr_ptr const & e , std::vector< expr_ptr > const & children )
+    {
+        double result = children[0]->eval();
+        switch( e->get_type() ){
+            case Plus: case Sum:
+                for( size_t i = 1; i < children.size(); ++i ) result += children[i]->eval();
+                return result;
+            case Multiplies: case Product:
+                for( size_t i = 1; i < children.size(); ++i ) result *= children[i]->eval();
+                return result;
+            case Minus:         return result - children[1]->eval();
+            case Divides:       return result / children[1]->eval();
+            case Comparison:    return compare_values( e->to_string(), result, children[1]->eval() ) ? 1.0 : 0.0;
+            case Min:           return std::min( result, children[1]->eval() );
+            case Max:           return std::max( result, children[1]->eval() );
+            case Select:        return result != 0.0 ? children[1]->eval() : children[2]->eval();
+            case UnaryFunc: default:
+                return e->to_string() == std::string { "cos" } ? std::cos( result ) : std::sin( result );
+        }
+    }
+
+    inline expr_ptr specialize_impl( const_expr_ptr const & e , variable_bindings const & known ,
+                                     std::unordered_map< expr const * , expr_ptr > & done )
+    {
+        auto found = done.find( e.get() );
+        if( found != done.end() ) return found->second;
+
+        expr_ptr result = nullptr;
+        if( e->get_type() == Constant ){
+            result = make_constant( e->eval() );
+        } else if( e->get_type() == Variable ){
+            auto value = known.find( get_variable_index( e ) );
+            result = value != known.end() ? make_constant( value->second ) : make_node_like( e );
+        } else {
+            std::vector< expr_ptr > children( e->num_children() );
+            bool all_constant = true;
+            for( size_t i = 0; i != e->num_children(); ++i ){
+                children[i] = specialize_impl( e->get_children( i ) , known , done );
+                all_constant = all_constant && children[i]->get_type() == Constant;
+            }
+            result = all_constant ? make_constant( fold( e , children ) ) : make_node_like( e , std::move( children ) );
+        }
+        done.insert( { e.get() , result } );
+        return result;
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: specialize
+ * @param: expression, known variable values ( by index )
+ * @return: residual expression
+ * Substitutes every bound variable by its value and folds each subtree that became constant. The input tree is
+ * left untouched; the residual is an ordinary tree over the free variables only, so evaluate_expr, to_polish and
+ * evaluation_plan all accept it. Shared subtrees of a DAG are specialized once and stay shared.
+ */
+    inline expr_ptr specialize( const_expr_ptr const & e , variable_bindings const & known )
+    {
+        assert( e );
+        std::unordered_map< expr const * , expr_ptr > done {};
+        return detail::specialize_impl( e , known , done );
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_SPECIALIZE_H_INCLUDED
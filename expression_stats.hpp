@@ -0,0 +1,68 @@
+#ifndef EXPRESSION_STATS_H_INCLUDED
+#define EXPRESSION_STATS_H_INCLUDED
+
+#include "expressions.hpp"
+#include "memory_statistics.hpp"
+#include <ostream>
+
+namespace Expression
+{
+    /*
+     * Byte counts are estimates for the layout produced by std::make_shared: the node object itself ( payload,
+     * including the context_expr_eval array embedded in every variable and the operand array of n-ary nodes ),
+     * the shared_ptr control block allocated alongside it, and heap memory owned by strings. This tree keeps no
+     * strings in its nodes, so string_bytes is always 0 here; see expr/edited_expression_stats.hpp for the
+     * named variant.
+     */
+    using memory_statistics = basic_memory_statistics< expression_type >;
+
+    namespace detail {
+
+    inline size_t payload_estimate( const_expr_ptr const & e )
+    {
+        switch( e->get_type() ){
+            case Constant:      return sizeof( constant );
+            case Variable:      return sizeof( variable< 0 > );
+            case Plus:          return sizeof( plus_node );
+            case Minus:         return sizeof( minus_node );
+            case Divides:       return sizeof( divides_node );
+            case Multiplies:    return sizeof( multiplies_node );
+            case Comparison:    return sizeof( less_node );
+            case Min:           return sizeof( min_node );
+            case Max:           return sizeof( max_node );
+            case Select:        return sizeof( select_node );
+            case Sum: case Product:
+                return sizeof( sum_node ) + static_cast< nary_expr const * >( e.get() )->children().capacity() * sizeof( expr_ptr );
+            case UnaryFunc: case None: default:
+                return sizeof( sin_node );
+        }
+    }
+
+    } // namespace detail
+
+    // See detail::memory_walk for what is counted.
+    inline memory_statistics memory_stats( const_expr_ptr const & root )
+    {
+        return detail::memory_walk< expression_type >( root,
+            []( const_expr_ptr const & e ){ return e->num_children(); },
+            []( const_expr_ptr const & e ){ return detail::payload_estimate( e ); },
+            []( const_expr_ptr const & ){ return size_t( 0 ); } );
+    }
+
+    inline std::ostream & operator<<( std::ostream & out, memory_statistics const & stats )
+    {
+        static char const * const names[] = { "None", "Constant", "Variable", "Plus", "Minus", "Divides",
+                                              "Multiplies", "UnaryFunc", "Sum", "Product",
+                                              "Comparison", "Min", "Max", "Select" };
+        out << "nodes: " << stats.unique_nodes << " unique, " << stats.shared_nodes << " shared, "
+            << stats.references << " references, depth " << stats.depth << "\n";
+        for( auto const & entry : stats.nodes_by_type ){
+            out << "  " << names[ entry.first ] << ": " << entry.second << "\n";
+        }
+        out << "bytes: " << stats.total_bytes() << " ( payload " << stats.payload_bytes << ", control blocks "
+            << stats.control_block_bytes << ", strings " << stats.string_bytes << " )\n";
+        return out;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_STATS_H_INCLUDED
@@ -0,0 +1,474 @@
+#ifndef EXPRESSION_STORE_H_INCLUDED
+#define EXPRESSION_STORE_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <limits>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Expression
+{
+    /*
+     * On-disk layout. Everything is addressed by offsets from the start of the file, so the mapping can sit at any
+     * address, and integers are in host byte order:
+     *
+     *   store_header
+     *   store_entry[ count ]            indexed by id
+     *   uint32_t[ count ]               ids sorted by name, for binary search
+     *   names                           all names back to back, not terminated
+     *   store_node[ ... ]               8-byte aligned; each expression is a contiguous run in postfix order
+     */
+    namespace detail {
+
+    constexpr char store_magic[8] = { 'E', 'X', 'P', 'R', 'S', 'T', 'O', 'R' };
+    constexpr std::uint32_t store_version = 2;
+
+    enum class store_op : std::uint32_t { Constant, Variable, Plus, Minus, Multiplies, Divides, Sin, Cos, Sum, Product,
+                                          Less, LessEqual, Greater, GreaterEqual, Equal, Min, Max, Select };
+
+    struct store_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t count;
+        std::uint64_t entries_offset;
+        std::uint64_t sorted_offset;
+        std::uint64_t names_offset;
+        std::uint64_t nodes_offset;
+        std::uint64_t file_size;
+    };
+
+    struct store_entry
+    {
+        std::uint64_t first_node;       // index into the node array
+        std::uint32_t node_count;
+        std::uint32_t name_length;
+        std::uint64_t name_offset;      // into the names blob
+    };
+
+    struct store_node
+    {
+        store_op op;
+        std::uint32_t operand;          // variable index, or number of children of Sum and Product
+        double value;
+    };
+
+    inline void append_postfix( const_expr_ptr const & e, std::vector< store_node > & nodes )
+    {
+        for( size_t i = 0; i != e->num_children(); ++i ) append_postfix( e->get_children( i ), nodes );
+        store_node node { store_op::Constant, 0, 0.0 };
+        switch( e->get_type() ){
+            case Constant:      node.value = e->eval(); break;
+            case Variable:      node.op = store_op::Variable; node.operand = static_cast< std::uint32_t >( get_variable_index( e ) ); break;
+            case Plus:          node.op = store_op::Plus; break;
+            case Minus:         node.op = store_op::Minus; break;
+            case Multiplies:    node.op = store_op::Multiplies; break;
+            case Divides:       node.op = store_op::Divides; break;
+            case Sum:           node.op = store_op::Sum; node.operand = static_cast< std::uint32_t >( e->num_children() ); break;
+            case Product:       node.op = store_op::Product; node.operand = static_cast< std::uint32_t >( e->num_children() ); break;
+            case UnaryFunc:     node.op = e->to_string() == "cos" ? store_op::Cos : store_op::Sin; break;
+            case Min:           node.op = store_op::Min; break;
+            case Max:           node.op = store_op::Max; break;
+            case Select:        node.op = store_op::Select; break;
+            case Comparison: {
+                std::string const op = e->to_string();
+                node.op = op == "<" ? store_op::Less : op == "<=" ? store_op::LessEqual : op == ">" ? store_op::Greater
+                        : op == ">=" ? store_op::GreaterEqual : store_op::Equal;
+                break;
+            }
+            default:            throw std::invalid_argument( "expression store: node without a stored form" );
+        }
+        nodes.push_back( node );
+    }
+
+    template< typename T >
+    inline void write_at( std::vector< char > & out, size_t const & offset, T const & value )
+    {
+        std::memcpy( out.data() + offset, &value, sizeof( T ) );
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: write_store
+ * @param: file name, ( name, expression ) pairs
+ * Writes the expressions in the layout above; the id of an expression is its position in the list and names must
+ * be unique. Shared subtrees are written once per reference.
+ */
+    inline void write_store( std::string const & path, std::vector< std::pair< std::string, const_expr_ptr > > const & expressions )
+    {
+        using namespace detail;
+        std::vector< store_entry > entries( expressions.size() );
+        std::vector< store_node > nodes {};
+        std::string names {};
+        for( size_t id = 0; id != expressions.size(); ++id ){
+            entries[id].first_node = nodes.size();
+            entries[id].name_offset = names.size();
+            entries[id].name_length = static_cast< std::uint32_t >( expressions[id].first.size() );
+            names += expressions[id].first;
+            append_postfix( expressions[id].second, nodes );
+            entries[id].node_count = static_cast< std::uint32_t >( nodes.size() - entries[id].first_node );
+        }
+        std::vector< std::uint32_t > sorted( expressions.size() );
+        for( size_t id = 0; id != sorted.size(); ++id ) sorted[id] = static_cast< std::uint32_t >( id );
+        std::sort( sorted.begin(), sorted.end(), [&]( std::uint32_t const a, std::uint32_t const b ){ return expressions[a].first < expressions[b].first; } );
+        for( size_t i = 1; i < sorted.size(); ++i ){
+            if( expressions[ sorted[ i - 1 ] ].first == expressions[ sorted[i] ].first ) throw std::invalid_argument( "expression store: duplicate name " + expressions[ sorted[i] ].first );
+        }
+
+        store_header header {};
+        std::memcpy( header.magic, store_magic, sizeof( store_magic ) );
+        header.version = store_version;
+        header.count = static_cast< std::uint32_t >( expressions.size() );
+        header.entries_offset = sizeof( store_header );
+        header.sorted_offset = header.entries_offset + entries.size() * sizeof( store_entry );
+        header.names_offset = header.sorted_offset + sorted.size() * sizeof( std::uint32_t );
+        header.nodes_offset = ( header.names_offset + names.size() + 7 ) / 8 * 8;
+        header.file_size = header.nodes_offset + nodes.size() * sizeof( store_node );
+
+        std::vector< char > out( header.file_size, 0 );
+        write_at( out, 0, header );
+        if( !entries.empty() ) std::memcpy( out.data() + header.entries_offset, entries.data(), entries.size() * sizeof( store_entry ) );
+        if( !sorted.empty() ) std::memcpy( out.data() + header.sorted_offset, sorted.data(), sorted.size() * sizeof( std::uint32_t ) );
+        if( !names.empty() ) std::memcpy( out.data() + header.names_offset, names.data(), names.size() );
+        if( !nodes.empty() ) std::memcpy( out.data() + header.nodes_offset, nodes.data(), nodes.size() * sizeof( store_node ) );
+
+        std::ofstream file( path, std::ios::binary | std::ios::trunc );
+        file.write( out.data(), static_cast< std::streamsize >( out.size() ) );
+        if( !file ) throw std::runtime_error( "expression store: cannot write " + path );
+    }
+
+/*
+ *
+ * name: expression_store
+ * A store file mapped read-only. Opening maps the file and checks only the header: that the entry table, name
+ * index, names and nodes lie inside the file. It reads no entry and allocates one pointer per 4096 expressions, and
+ * the per-id caches are allocated a chunk at a time on first use. An entry's name and node run are bounds-checked
+ * whenever the entry is read, and the node run itself is checked on its first use ( ops, operand counts, a single
+ * result ). A malformed file throws std::runtime_error. find() binary searches the sorted name index in the
+ * mapping, evaluate() runs the postfix nodes straight from the mapped pages,
+ * and get() builds an expr_ptr only on the first request for an id and caches it; concurrent first requests may
+ * each build one, but all callers get the same tree.
+ */
+    class expression_store
+    {
+    public:
+        static constexpr size_t npos = static_cast< size_t >( -1 );
+
+        explicit expression_store( std::string const & path )
+        : m_base{ nullptr }, m_length{ 0 }, m_header{ nullptr }, m_names_bytes{ 0 }, m_total_nodes{ 0 }, m_chunks{}
+        {
+            int const fd = ::open( path.c_str(), O_RDONLY );
+            if( fd < 0 ) throw std::runtime_error( "expression store: cannot open " + path );
+            struct stat info {};
+            if( ::fstat( fd, &info ) != 0 || static_cast< size_t >( info.st_size ) < sizeof( detail::store_header ) ){
+                ::close( fd );
+                throw std::runtime_error( "expression store: " + path + " is too short" );
+            }
+            m_length = static_cast< size_t >( info.st_size );
+            void *mapping = ::mmap( nullptr, m_length, PROT_READ, MAP_PRIVATE, fd, 0 );
+            ::close( fd );
+            if( mapping == MAP_FAILED ) throw std::runtime_error( "expression store: cannot map " + path );
+            m_base = static_cast< char const * >( mapping );
+            m_header = reinterpret_cast< detail::store_header const * >( m_base );
+            if( !valid_layout() ){
+                ::munmap( mapping, m_length );
+                throw std::runtime_error( "expression store: " + path + " is not a valid store" );
+            }
+            m_names_bytes = m_header->nodes_offset - m_header->names_offset;
+            m_total_nodes = ( m_length - m_header->nodes_offset ) / sizeof( detail::store_node );
+            m_chunks.reset( new std::atomic< cache_chunk * >[ num_chunks() ]() );
+        }
+        expression_store( expression_store const & ) = delete;
+        expression_store & operator=( expression_store const & ) = delete;
+        ~expression_store()
+        {
+            for( size_t i = 0; i != num_chunks(); ++i ) delete m_chunks[i].load();
+            ::munmap( const_cast< char * >( m_base ), m_length );
+        }
+
+        size_t size( void ) const { return m_header->count; }
+
+        std::string name( size_t const & id ) const
+        {
+            detail::store_entry const & e = entry( id );
+            return std::string( m_base + m_header->names_offset + e.name_offset, e.name_length );
+        }
+
+        size_t find( std::string const & name ) const
+        {
+            std::uint32_t const *sorted = reinterpret_cast< std::uint32_t const * >( m_base + m_header->sorted_offset );
+            size_t first = 0, last = m_header->count;
+            while( first < last ){
+                size_t const middle = first + ( last - first ) / 2;
+                if( sorted[ middle ] >= m_header->count ) throw std::runtime_error( "expression store: invalid name index" );
+                detail::store_entry const & e = entry( sorted[ middle ] );
+                int const order = compare( m_base + m_header->names_offset + e.name_offset, e.name_length, name );
+                if( order == 0 ) return sorted[ middle ];
+                if( order < 0 ) first = middle + 1; else last = middle;
+            }
+            return npos;
+        }
+
+        // Number of variables expression id reads, i.e. its highest variable index + 1.
+        size_t num_inputs( size_t const & id ) const { return checked_inputs( id ); }
+
+        // Evaluates from the mapped nodes; row[i] is the value of var<i>. Identical to evaluate_expr( get( id ) ).
+        double evaluate( size_t const & id, double const *row ) const
+        {
+            checked_inputs( id );
+            detail::store_entry const & e = entry( id );
+            detail::store_node const *node = nodes() + e.first_node;
+            std::vector< double > stack {};
+            stack.reserve( 32 );
+            for( std::uint32_t i = 0; i != e.node_count; ++i, ++node ){
+                double right = 0.0;
+                switch( node->op ){
+                    case detail::store_op::Constant:    stack.push_back( node->value ); continue;
+                    case detail::store_op::Variable:    stack.push_back( row[ node->operand ] ); continue;
+                    case detail::store_op::Sin:         stack.back() = std::sin( stack.back() ); continue;
+                    case detail::store_op::Cos:         stack.back() = std::cos( stack.back() ); continue;
+                    case detail::store_op::Sum: case detail::store_op::Product: {
+                        double *first = stack.data() + stack.size() - node->operand;
+                        double result = first[0];
+                        for( std::uint32_t k = 1; k < node->operand; ++k ){
+                            if( node->op == detail::store_op::Sum ) result += first[k]; else result *= first[k];
+                        }
+                        stack.resize( stack.size() - node->operand );
+                        stack.push_back( result );
+                        continue;
+                    }
+                    case detail::store_op::Select: {
+                        double const b = stack.back();
+                        stack.pop_back();
+                        double const a = stack.back();
+                        stack.pop_back();
+                        stack.back() = stack.back() != 0.0 ? a : b;
+                        continue;
+                    }
+                    default: break;
+                }
+                right = stack.back();
+                stack.pop_back();
+                switch( node->op ){
+                    case detail::store_op::Plus:        stack.back() = stack.back() + right; break;
+                    case detail::store_op::Minus:       stack.back() = stack.back() - right; break;
+                    case detail::store_op::Multiplies:  stack.back() = stack.back() * right; break;
+                    case detail::store_op::Less:        stack.back() = stack.back() < right ? 1.0 : 0.0; break;
+                    case detail::store_op::LessEqual:   stack.back() = stack.back() <= right ? 1.0 : 0.0; break;
+                    case detail::store_op::Greater:     stack.back() = stack.back() > right ? 1.0 : 0.0; break;
+                    case detail::store_op::GreaterEqual:stack.back() = stack.back() >= right ? 1.0 : 0.0; break;
+                    case detail::store_op::Equal:       stack.back() = stack.back() == right ? 1.0 : 0.0; break;
+                    case detail::store_op::Min:         stack.back() = std::min( stack.back(), right ); break;
+                    case detail::store_op::Max:         stack.back() = std::max( stack.back(), right ); break;
+                    default:                            stack.back() = stack.back() / right; break;
+                }
+            }
+            assert( stack.size() == 1 );
+            return stack.back();
+        }
+
+        // with every variable bound to its context_expr_eval value, like evaluate_expr
+        double evaluate( size_t const & id ) const
+        {
+            context_expr_eval const context {};
+            double row[20];
+            if( checked_inputs( id ) > 20 ) throw std::out_of_range( "expression store: variable without a default value" );
+            for( int i = 0; i != 20; ++i ) row[i] = context.get( i );
+            return evaluate( id, row );
+        }
+
+        const_expr_ptr get( size_t const & id ) const
+        {
+            entry( id );
+            const_expr_ptr & slot = chunk( id ).trees[ id % chunk_size ];
+            const_expr_ptr cached = std::atomic_load( &slot );
+            if( cached ) return cached;
+            const_expr_ptr built = materialize( id );
+            const_expr_ptr expected {};
+            if( std::atomic_compare_exchange_strong( &slot, &expected, built ) ) return built;
+            return expected;
+        }
+
+    private:
+
+        static constexpr size_t chunk_size = 4096;
+
+        // The per-id caches, allocated chunk_size ids at a time on first use, so opening allocates nothing per id.
+        struct cache_chunk
+        {
+            const_expr_ptr trees[ chunk_size ];
+            std::atomic< std::uint32_t > inputs[ chunk_size ];     // inputs + 1, 0 until the node run was checked
+        };
+
+        size_t num_chunks( void ) const { return ( m_header->count + chunk_size - 1 ) / chunk_size; }
+
+        cache_chunk & chunk( size_t const & id ) const
+        {
+            std::atomic< cache_chunk * > & slot = m_chunks[ id / chunk_size ];
+            cache_chunk *current = slot.load( std::memory_order_acquire );
+            if( current ) return *current;
+            std::unique_ptr< cache_chunk > fresh( new cache_chunk() );
+            if( slot.compare_exchange_strong( current, fresh.get(), std::memory_order_acq_rel ) ) return *fresh.release();
+            return *current;
+        }
+
+        // offset + bytes lies inside the mapping, without overflow
+        bool inside( std::uint64_t const & offset, std::uint64_t const & bytes ) const
+        {
+            return offset <= m_length && bytes <= m_length - offset;
+        }
+
+        bool valid_layout( void ) const
+        {
+            detail::store_header const & h = *m_header;
+            if( std::memcmp( h.magic, detail::store_magic, sizeof( detail::store_magic ) ) != 0
+                || h.version != detail::store_version || h.file_size != m_length ) return false;
+            if( h.entries_offset % alignof( detail::store_entry ) != 0 || h.sorted_offset % alignof( std::uint32_t ) != 0
+                || h.nodes_offset % alignof( detail::store_node ) != 0 ) return false;
+            if( !inside( h.entries_offset, std::uint64_t( h.count ) * sizeof( detail::store_entry ) )
+                || !inside( h.sorted_offset, std::uint64_t( h.count ) * sizeof( std::uint32_t ) )
+                || !inside( h.nodes_offset, 0 ) || h.names_offset > h.nodes_offset ) return false;
+            return ( m_length - h.nodes_offset ) % sizeof( detail::store_node ) == 0;
+        }
+
+        /*
+         * Checks the node run of id once and caches the number of variables it reads, plus one so that a zeroed
+         * chunk means unchecked: every op is known, every op finds its operands on the stack and exactly one value
+         * remains, so evaluate and materialize never read past the run or an empty stack.
+         */
+        size_t checked_inputs( size_t const & id ) const
+        {
+            detail::store_entry const & e = entry( id );
+            std::atomic< std::uint32_t > & cached = chunk( id ).inputs[ id % chunk_size ];
+            std::uint32_t inputs = cached.load( std::memory_order_acquire );
+            if( inputs != 0 ) return inputs - 1;
+            detail::store_node const *node = nodes() + e.first_node;
+            std::uint64_t depth = 0;
+            inputs = 0;
+            for( std::uint32_t i = 0; i != e.node_count; ++i, ++node ){
+                std::uint64_t operands = 0;
+                switch( node->op ){
+                    case detail::store_op::Constant:    break;
+                    case detail::store_op::Variable:
+                        if( node->operand >= static_cast< std::uint32_t >( std::numeric_limits< int >::max() ) ) throw std::runtime_error( "expression store: invalid variable index" );
+                        inputs = std::max( inputs, node->operand + 1 );
+                        break;
+                    case detail::store_op::Sin: case detail::store_op::Cos:
+                        operands = 1; break;
+                    case detail::store_op::Sum: case detail::store_op::Product:
+                        if( node->operand == 0 ) throw std::runtime_error( "expression store: empty Sum or Product" );
+                        operands = node->operand; break;
+                    case detail::store_op::Select:
+                        operands = 3; break;
+                    case detail::store_op::Plus: case detail::store_op::Minus: case detail::store_op::Multiplies:
+                    case detail::store_op::Divides: case detail::store_op::Less: case detail::store_op::LessEqual:
+                    case detail::store_op::Greater: case detail::store_op::GreaterEqual: case detail::store_op::Equal:
+                    case detail::store_op::Min: case detail::store_op::Max:
+                        operands = 2; break;
+                    default:
+                        throw std::runtime_error( "expression store: unknown node op" );
+                }
+                if( operands > depth ) throw std::runtime_error( "expression store: node without its operands" );
+                depth = depth - operands + 1;
+            }
+            if( depth != 1 ) throw std::runtime_error( "expression store: expression does not leave one value" );
+            cached.store( inputs + 1, std::memory_order_release );
+            return inputs;
+        }
+
+        // The entry of id, with its name and node run checked to lie inside the names and the node array.
+        detail::store_entry const & entry( size_t const & id ) const
+        {
+            if( id >= m_header->count ) throw std::out_of_range( "expression store: no expression with this id" );
+            detail::store_entry const & e = reinterpret_cast< detail::store_entry const * >( m_base + m_header->entries_offset )[ id ];
+            if( e.name_offset > m_names_bytes || e.name_length > m_names_bytes - e.name_offset
+                || e.node_count == 0 || e.first_node > m_total_nodes || e.node_count > m_total_nodes - e.first_node ){
+                throw std::runtime_error( "expression store: entry outside the file" );
+            }
+            return e;
+        }
+
+        detail::store_node const * nodes( void ) const
+        {
+            return reinterpret_cast< detail::store_node const * >( m_base + m_header->nodes_offset );
+        }
+
+        static int compare( char const *stored, size_t const & length, std::string const & name )
+        {
+            int const order = std::memcmp( stored, name.data(), std::min( length, name.size() ) );
+            if( order != 0 ) return order;
+            return length < name.size() ? -1 : length > name.size() ? 1 : 0;
+        }
+
+        const_expr_ptr materialize( size_t const & id ) const
+        {
+            checked_inputs( id );
+            detail::store_entry const & e = entry( id );
+            detail::store_node const *node = nodes() + e.first_node;
+            std::vector< expr_ptr > stack {};
+            for( std::uint32_t i = 0; i != e.node_count; ++i, ++node ){
+                expr_ptr right {};
+                switch( node->op ){
+                    case detail::store_op::Constant:    stack.push_back( make_constant( node->value ) ); continue;
+                    case detail::store_op::Variable:    stack.push_back( make_variable_with_index<>( static_cast< int >( node->operand ) ) ); continue;
+                    case detail::store_op::Sin:         stack.back() = make_sin( stack.back() ); continue;
+                    case detail::store_op::Cos:         stack.back() = make_cos( stack.back() ); continue;
+                    case detail::store_op::Sum: case detail::store_op::Product: {
+                        std::vector< expr_ptr > children( stack.end() - node->operand, stack.end() );
+                        stack.resize( stack.size() - node->operand );
+                        stack.push_back( node->op == detail::store_op::Sum ? make_sum( std::move( children ) ) : make_product( std::move( children ) ) );
+                        continue;
+                    }
+                    case detail::store_op::Select: {
+                        expr_ptr b = stack.back();
+                        stack.pop_back();
+                        expr_ptr a = stack.back();
+                        stack.pop_back();
+                        stack.back() = make_select( stack.back(), a, b );
+                        continue;
+                    }
+                    default: break;
+                }
+                right = stack.back();
+                stack.pop_back();
+                switch( node->op ){
+                    case detail::store_op::Plus:        stack.back() = make_plus( stack.back(), right ); break;
+                    case detail::store_op::Minus:       stack.back() = make_minus( stack.back(), right ); break;
+                    case detail::store_op::Multiplies:  stack.back() = make_multiplies( stack.back(), right ); break;
+                    case detail::store_op::Less:        stack.back() = make_less( stack.back(), right ); break;
+                    case detail::store_op::LessEqual:   stack.back() = make_less_equal( stack.back(), right ); break;
+                    case detail::store_op::Greater:     stack.back() = make_greater( stack.back(), right ); break;
+                    case detail::store_op::GreaterEqual:stack.back() = make_greater_equal( stack.back(), right ); break;
+                    case detail::store_op::Equal:       stack.back() = make_equal( stack.back(), right ); break;
+                    case detail::store_op::Min:         stack.back() = make_min( stack.back(), right ); break;
+                    case detail::store_op::Max:         stack.back() = make_max( stack.back(), right ); break;
+                    default:                            stack.back() = make_divided( stack.back(), right ); break;
+                }
+            }
+            assert( stack.size() == 1 );
+            return stack.back();
+        }
+
+        char const *m_base;
+        size_t m_length;
+        detail::store_header const *m_header;
+        std::uint64_t m_names_bytes;
+        std::uint64_t m_total_nodes;
+        std::unique_ptr< std::atomic< cache_chunk * >[] > m_chunks;
+    };
+} // namespace Expression
+
+#endif // EXPRESSION_STORE_H_INCLUDED
@@ -0,0 +1,150 @@
+#ifndef EXPRESSION_STREAMING_H_INCLUDED
+#define EXPRESSION_STREAMING_H_INCLUDED
+
+#include "expression_io.hpp"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace Expression
+{
+    namespace detail {
+
+    // An operator whose operands are still being read; missing counts the operands still to come and left/middle
+    // hold the ones already known.
+    struct pending_operator
+    {
+        char op;
+        int missing;
+        double left;
+        double middle;
+    };
+
+    inline double apply_operator( pending_operator const & frame, double const & operand )
+    {
+        switch( frame.op ){
+            case '+': return frame.left + operand;
+            case '-': return frame.left - operand;
+            case '*': return frame.left * operand;
+            case '/': return frame.left / operand;
+            case '<': return frame.left < operand ? 1.0 : 0.0;
+            case 'l': return frame.left <= operand ? 1.0 : 0.0;
+            case '>': return frame.left > operand ? 1.0 : 0.0;
+            case 'g': return frame.left >= operand ? 1.0 : 0.0;
+            case '=': return frame.left == operand ? 1.0 : 0.0;
+            case 'm': return std::min( frame.left, operand );
+            case 'M': return std::max( frame.left, operand );
+            case '?': return frame.left != 0.0 ? frame.middle : operand;
+            case 's': return std::sin( operand );
+            case 'c': default: return std::cos( operand );
+        }
+    }
+
+    inline char comparison_code( std::string const & op )
+    {
+        return op == "<" ? '<' : op == "<=" ? 'l' : op == ">" ? '>' : op == ">=" ? 'g' : '=';
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: evaluate_polish
+ * @param: Polish string, row[i] is the value of var<i>, number of values in row
+ * @return: value
+ * Evaluates while reading: operators are kept on a small stack until their operands have arrived, and every value
+ * that completes an operator is folded into it at once, so no node is built. Tokens come from the same Lexer and
+ * constants from the same to_double as in from_polish, and every operation is the one evaluate_expr performs, so
+ * the result is identical to evaluate_expr( from_polish( s ) ) with the same bindings. Like from_polish it stops at
+ * the end of the first complete expression; it throws if the string ends before that, and throws out_of_range for
+ * a variable with no value in row.
+ */
+    inline double evaluate_polish( std::string const & str, double const *row, size_t const & inputs )
+    {
+        Lexer lex ( str );
+        std::vector< detail::pending_operator > stack {};
+        stack.reserve( 32 );
+        for( ; ; ){
+            Lexer::token_type token = lex.get_token();
+            double value = 0.0;
+            switch( token.second ){
+                case expression_type::Plus:         stack.push_back( detail::pending_operator { '+', 2, 0.0, 0.0 } ); continue;
+                case expression_type::Minus:        stack.push_back( detail::pending_operator { '-', 2, 0.0, 0.0 } ); continue;
+                case expression_type::Multiplies:   stack.push_back( detail::pending_operator { '*', 2, 0.0, 0.0 } ); continue;
+                case expression_type::Divides:      stack.push_back( detail::pending_operator { '/', 2, 0.0, 0.0 } ); continue;
+                case expression_type::Comparison:
+                    stack.push_back( detail::pending_operator { detail::comparison_code( token.first.get_lexeme() ), 2, 0.0, 0.0 } );
+                    continue;
+                case expression_type::Constant:     value = to_double( token.first.get_lexeme() ); break;
+                case expression_type::Variable: case expression_type::UnaryFunc: {
+                    std::string const & name = token.first.get_lexeme();
+                    if( name == "sin" || name == "cos" ){
+                        stack.push_back( detail::pending_operator { name[0], 1, 0.0, 0.0 } );
+                        continue;
+                    }
+                    if( name == "min" || name == "max" || name == "select" ){
+                        char const op = name == "min" ? 'm' : name == "max" ? 'M' : '?';
+                        stack.push_back( detail::pending_operator { op, op == '?' ? 3 : 2, 0.0, 0.0 } );
+                        continue;
+                    }
+                    size_t const index = static_cast< size_t >( get_index_from( name ) );
+                    if( index >= inputs ) throw std::out_of_range( "evaluate_polish: variable without a value in the row" );
+                    value = row[ index ];
+                    break;
+                }
+                default:
+                    throw std::invalid_argument( "incomplete Polish expression" );
+            }
+            for( ; ; ){
+                if( stack.empty() ) return value;
+                detail::pending_operator & top = stack.back();
+                if( top.missing > 1 ){
+                    if( top.missing == 3 || top.op != '?' ) top.left = value; else top.middle = value;
+                    --top.missing;
+                    break;
+                }
+                value = detail::apply_operator( top, value );
+                stack.pop_back();
+            }
+        }
+    }
+
+    // with every variable bound to its context_expr_eval value, like evaluate_expr
+    inline double evaluate_polish( std::string const & str )
+    {
+        context_expr_eval const context {};
+        double row[20];
+        for( int i = 0; i != 20; ++i ) row[i] = context.get( i );
+        return evaluate_polish( str, row, 20 );
+    }
+
+    struct polish_latency
+    {
+        double tree_ns = 0.0;           // from_polish + evaluate_expr
+        double streaming_ns = 0.0;      // evaluate_polish
+        bool identical = false;
+    };
+
+    // Latency of evaluating str once, averaged over repeats single-use evaluations.
+    inline polish_latency time_polish_evaluation( std::string const & str, size_t const & repeats = 10000 )
+    {
+        using clock = std::chrono::steady_clock;
+        polish_latency result {};
+        double tree = 0.0, streaming = 0.0;
+
+        auto const start = clock::now();
+        for( size_t r = 0; r != repeats; ++r ) tree += evaluate_expr( from_polish( str ) );
+        auto const middle = clock::now();
+        for( size_t r = 0; r != repeats; ++r ) streaming += evaluate_polish( str );
+        auto const stop = clock::now();
+
+        result.tree_ns = std::chrono::duration< double, std::nano >( middle - start ).count() / repeats;
+        result.streaming_ns = std::chrono::duration< double, std::nano >( stop - middle ).count() / repeats;
+        result.identical = tree == streaming && evaluate_expr( from_polish( str ) ) == evaluate_polish( str );
+        return result;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_STREAMING_H_INCLUDED
@@ -0,0 +1,361 @@
+#ifndef EXPRESSION_TRIG_H_INCLUDED
+#define EXPRESSION_TRIG_H_INCLUDED
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <limits>
+#include <ostream>
+#if ( defined( __x86_64__ ) || defined( __i386__ ) ) && defined( __SSE2__ ) && defined( __GNUC__ )
+#define EXPRESSION_TRIG_X86 1
+#include <immintrin.h>
+#endif
+
+namespace Expression
+{
+    /*
+     * accurate calls std::sin / std::cos for every argument, so block results are identical to evaluate_expr.
+     * fast evaluates several arguments per instruction: Cody-Waite reduction by pi/2 with a four part constant,
+     * then the fdlibm minimax kernels on [ -pi/4, pi/4 ]. Its error against std::sin / std::cos is at most
+     * fast_trig_max_ulp units in the last place for |x| <= fast_trig_limit ( check_trig measures it ); larger,
+     * infinite and NaN arguments go to libm.
+     */
+    enum class trig_accuracy { accurate, fast };
+    enum class trig_isa { scalar, sse2, avx2 };
+
+    constexpr double fast_trig_limit = 1.0e6;      // keeps n = round( x * 2 / pi ) below 2^20, so n * pio2_1 is exact
+    constexpr double fast_trig_max_ulp = 2.0;
+
+    inline char const *to_string( trig_isa const & isa )
+    {
+        return isa == trig_isa::avx2 ? "avx2" : isa == trig_isa::sse2 ? "sse2" : "scalar";
+    }
+
+    // The widest kernel the running processor supports, detected once.
+    inline trig_isa best_trig_isa( void )
+    {
+#if defined( EXPRESSION_TRIG_X86 )
+        static trig_isa const isa = __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) ? trig_isa::avx2 : trig_isa::sse2;
+        return isa;
+#else
+        return trig_isa::scalar;
+#endif
+    }
+
+    namespace detail {
+
+    // pi/2 = pio2_1 + pio2_2 + pio2_3 + pio2_3t; the first three have at most 33 significant bits ( fdlibm )
+    constexpr double two_over_pi = 6.36619772367581382433e-01;
+    constexpr double pio2_1 = 1.57079632673412561417e+00;
+    constexpr double pio2_2 = 6.07710050630396597660e-11;
+    constexpr double pio2_3 = 2.02226624871116645580e-21;
+    constexpr double pio2_3t = 8.47842766036889956997e-32;
+    constexpr double round_shift = 6755399441055744.0;  // 1.5 * 2^52: adding it rounds to an integer held in the low bits
+
+    constexpr double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03, S3 = -1.98412698298579493134e-04,
+                     S4 = 2.75573137070700676789e-06, S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+    constexpr double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03, C3 = 2.48015872894767294178e-05,
+                     C4 = -2.75573143513906633035e-07, C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+
+    // shift is 0 for sin and 1 for cos: cos( x ) = sin( x + pi/2 ) is the next quadrant
+    inline double fast_trig( double const & x, std::uint64_t const & shift )
+    {
+        if( !( std::fabs( x ) <= fast_trig_limit ) ) return shift ? std::cos( x ) : std::sin( x );
+        double const t = x * two_over_pi + round_shift;
+        double const n = t - round_shift;
+        std::uint64_t q = 0;
+        std::memcpy( &q, &t, sizeof( q ) );
+        q += shift;
+        double r = x - n * pio2_1;
+        r = r - n * pio2_2;
+        r = r - n * pio2_3;
+        r = r - n * pio2_3t;
+        double const z = r * r;
+        double const s = r + z * r * ( S1 + z * ( S2 + z * ( S3 + z * ( S4 + z * ( S5 + z * S6 ) ) ) ) );
+        double const hz = 0.5 * z, w = 1.0 - hz;
+        double const c = w + ( ( ( 1.0 - w ) - hz ) + z * z * ( C1 + z * ( C2 + z * ( C3 + z * ( C4 + z * ( C5 + z * C6 ) ) ) ) ) );
+        double const v = q & 1 ? c : s;
+        return q & 2 ? -v : v;
+    }
+
+    inline void fast_trig_scalar( double const *x, double *out, size_t const & n, std::uint64_t const & shift )
+    {
+        for( size_t j = 0; j != n; ++j ) out[j] = fast_trig( x[j], shift );
+    }
+
+#if defined( EXPRESSION_TRIG_X86 )
+    inline __m128d fast_trig_sse2( __m128d const x, std::uint64_t const & shift )
+    {
+        __m128d const t = _mm_add_pd( _mm_mul_pd( x, _mm_set1_pd( two_over_pi ) ), _mm_set1_pd( round_shift ) );
+        __m128d const n = _mm_sub_pd( t, _mm_set1_pd( round_shift ) );
+        __m128i const q = _mm_add_epi64( _mm_castpd_si128( t ), _mm_set1_epi64x( static_cast< long long >( shift ) ) );
+        __m128d r = _mm_sub_pd( x, _mm_mul_pd( n, _mm_set1_pd( pio2_1 ) ) );
+        r = _mm_sub_pd( r, _mm_mul_pd( n, _mm_set1_pd( pio2_2 ) ) );
+        r = _mm_sub_pd( r, _mm_mul_pd( n, _mm_set1_pd( pio2_3 ) ) );
+        r = _mm_sub_pd( r, _mm_mul_pd( n, _mm_set1_pd( pio2_3t ) ) );
+        __m128d const z = _mm_mul_pd( r, r );
+
+        __m128d ps = _mm_add_pd( _mm_set1_pd( S5 ), _mm_mul_pd( z, _mm_set1_pd( S6 ) ) );
+        ps = _mm_add_pd( _mm_set1_pd( S4 ), _mm_mul_pd( z, ps ) );
+        ps = _mm_add_pd( _mm_set1_pd( S3 ), _mm_mul_pd( z, ps ) );
+        ps = _mm_add_pd( _mm_set1_pd( S2 ), _mm_mul_pd( z, ps ) );
+        ps = _mm_add_pd( _mm_set1_pd( S1 ), _mm_mul_pd( z, ps ) );
+        __m128d const s = _mm_add_pd( r, _mm_mul_pd( _mm_mul_pd( z, r ), ps ) );
+
+        __m128d pc = _mm_add_pd( _mm_set1_pd( C5 ), _mm_mul_pd( z, _mm_set1_pd( C6 ) ) );
+        pc = _mm_add_pd( _mm_set1_pd( C4 ), _mm_mul_pd( z, pc ) );
+        pc = _mm_add_pd( _mm_set1_pd( C3 ), _mm_mul_pd( z, pc ) );
+        pc = _mm_add_pd( _mm_set1_pd( C2 ), _mm_mul_pd( z, pc ) );
+        pc = _mm_add_pd( _mm_set1_pd( C1 ), _mm_mul_pd( z, pc ) );
+        __m128d const hz = _mm_mul_pd( _mm_set1_pd( 0.5 ), z );
+        __m128d const w = _mm_sub_pd( _mm_set1_pd( 1.0 ), hz );
+        __m128d const tail = _mm_add_pd( _mm_sub_pd( _mm_sub_pd( _mm_set1_pd( 1.0 ), w ), hz ), _mm_mul_pd( _mm_mul_pd( z, z ), pc ) );
+        __m128d const c = _mm_add_pd( w, tail );
+
+        // bit 0 of the quadrant picks the kernel, bit 1 the sign; SSE2 has no 64-bit arithmetic shift, so the
+        // mask is spread from the upper half of each lane
+        __m128i const odd = _mm_srai_epi32( _mm_shuffle_epi32( _mm_slli_epi64( q, 63 ), _MM_SHUFFLE( 3, 3, 1, 1 ) ), 31 );
+        __m128d const mask = _mm_castsi128_pd( odd );
+        __m128d const v = _mm_or_pd( _mm_and_pd( mask, c ), _mm_andnot_pd( mask, s ) );
+        return _mm_xor_pd( v, _mm_castsi128_pd( _mm_slli_epi64( _mm_srli_epi64( q, 1 ), 63 ) ) );
+    }
+
+    inline void fast_trig_sse2( double const *x, double *out, size_t const & n, std::uint64_t const & shift )
+    {
+        __m128d const limit = _mm_set1_pd( fast_trig_limit );
+        __m128d const abs_mask = _mm_castsi128_pd( _mm_set1_epi64x( 0x7fffffffffffffffLL ) );
+        double in[2], result[2];
+        for( size_t j = 0; j < n; j += 2 ){
+            size_t const m = n - j < 2 ? n - j : 2;
+            __m128d v;
+            if( m == 2 ){
+                v = _mm_loadu_pd( x + j );
+            } else {
+                in[0] = x[j];
+                in[1] = 0.0;
+                v = _mm_loadu_pd( in );
+            }
+            __m128d const y = fast_trig_sse2( v, shift );
+            // not-less-or-equal is also true for NaN
+            bool const outside = _mm_movemask_pd( _mm_cmpnle_pd( _mm_and_pd( v, abs_mask ), limit ) ) != 0;
+            if( m == 2 && !outside ){
+                _mm_storeu_pd( out + j, y );
+                continue;
+            }
+            _mm_storeu_pd( result, y );
+            if( outside ){
+                _mm_storeu_pd( in, v );
+                for( size_t k = 0; k != m; ++k ) result[k] = fast_trig( in[k], shift );
+            }
+            std::memcpy( out + j, result, m * sizeof( double ) );
+        }
+    }
+
+    __attribute__(( target( "avx2,fma" ) ))
+    inline void fast_trig_avx2( double const *x, double *out, size_t const & n, std::uint64_t const & shift )
+    {
+        __m256d const limit = _mm256_set1_pd( fast_trig_limit );
+        __m256d const abs_mask = _mm256_castsi256_pd( _mm256_set1_epi64x( 0x7fffffffffffffffLL ) );
+        __m256d const one = _mm256_set1_pd( 1.0 );
+        double in[4], result[4];
+        for( size_t j = 0; j < n; j += 4 ){
+            size_t const m = n - j < 4 ? n - j : 4;
+            __m256d x4;
+            if( m == 4 ){
+                x4 = _mm256_loadu_pd( x + j );
+            } else {
+                in[0] = in[1] = in[2] = in[3] = 0.0;
+                std::memcpy( in, x + j, m * sizeof( double ) );
+                x4 = _mm256_loadu_pd( in );
+            }
+            __m256d const t = _mm256_fmadd_pd( x4, _mm256_set1_pd( two_over_pi ), _mm256_set1_pd( round_shift ) );
+            __m256d const nq = _mm256_sub_pd( t, _mm256_set1_pd( round_shift ) );
+            __m256i const q = _mm256_add_epi64( _mm256_castpd_si256( t ), _mm256_set1_epi64x( static_cast< long long >( shift ) ) );
+            __m256d r = _mm256_fnmadd_pd( nq, _mm256_set1_pd( pio2_1 ), x4 );
+            r = _mm256_fnmadd_pd( nq, _mm256_set1_pd( pio2_2 ), r );
+            r = _mm256_fnmadd_pd( nq, _mm256_set1_pd( pio2_3 ), r );
+            r = _mm256_fnmadd_pd( nq, _mm256_set1_pd( pio2_3t ), r );
+            __m256d const z = _mm256_mul_pd( r, r );
+
+            __m256d ps = _mm256_fmadd_pd( z, _mm256_set1_pd( S6 ), _mm256_set1_pd( S5 ) );
+            ps = _mm256_fmadd_pd( z, ps, _mm256_set1_pd( S4 ) );
+            ps = _mm256_fmadd_pd( z, ps, _mm256_set1_pd( S3 ) );
+            ps = _mm256_fmadd_pd( z, ps, _mm256_set1_pd( S2 ) );
+            ps = _mm256_fmadd_pd( z, ps, _mm256_set1_pd( S1 ) );
+            __m256d const s = _mm256_fmadd_pd( _mm256_mul_pd( z, r ), ps, r );
+
+            __m256d pc = _mm256_fmadd_pd( z, _mm256_set1_pd( C6 ), _mm256_set1_pd( C5 ) );
+            pc = _mm256_fmadd_pd( z, pc, _mm256_set1_pd( C4 ) );
+            pc = _mm256_fmadd_pd( z, pc, _mm256_set1_pd( C3 ) );
+            pc = _mm256_fmadd_pd( z, pc, _mm256_set1_pd( C2 ) );
+            pc = _mm256_fmadd_pd( z, pc, _mm256_set1_pd( C1 ) );
+            __m256d const hz = _mm256_mul_pd( _mm256_set1_pd( 0.5 ), z );
+            __m256d const w = _mm256_sub_pd( one, hz );
+            __m256d const tail = _mm256_fmadd_pd( _mm256_mul_pd( z, z ), pc, _mm256_sub_pd( _mm256_sub_pd( one, w ), hz ) );
+            __m256d const c = _mm256_add_pd( w, tail );
+
+            __m256d const v = _mm256_blendv_pd( s, c, _mm256_castsi256_pd( _mm256_slli_epi64( q, 63 ) ) );
+            __m256d const y = _mm256_xor_pd( v, _mm256_castsi256_pd( _mm256_slli_epi64( _mm256_srli_epi64( q, 1 ), 63 ) ) );
+            bool const outside = _mm256_movemask_pd( _mm256_cmp_pd( _mm256_and_pd( x4, abs_mask ), limit, _CMP_NLE_UQ ) ) != 0;
+            if( m == 4 && !outside ){
+                _mm256_storeu_pd( out + j, y );
+                continue;
+            }
+            _mm256_storeu_pd( result, y );
+            if( outside ){
+                _mm256_storeu_pd( in, x4 );
+                for( size_t k = 0; k != m; ++k ){
+                    if( !( std::fabs( in[k] ) <= fast_trig_limit ) ) result[k] = shift ? std::cos( in[k] ) : std::sin( in[k] );
+                }
+            }
+            std::memcpy( out + j, result, m * sizeof( double ) );
+        }
+    }
+#endif
+
+    inline void fast_trig_block( double const *x, double *out, size_t const & n, std::uint64_t const & shift, trig_isa const & isa )
+    {
+        switch( isa ){
+#if defined( EXPRESSION_TRIG_X86 )
+            case trig_isa::avx2:    fast_trig_avx2( x, out, n, shift ); return;
+            case trig_isa::sse2:    fast_trig_sse2( x, out, n, shift ); return;
+#endif
+            default:                fast_trig_scalar( x, out, n, shift ); return;
+        }
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: sin_block, cos_block
+ * @param: arguments, results, count, accuracy
+ * out[j] = sin( x[j] ) for j < n; out may be x. The fast mode runs the widest kernel the processor has; for other
+ * scalar types than double both modes use the standard library.
+ */
+    template< typename T >
+    inline void sin_block( T const *x, T *out, size_t const & n, trig_accuracy const & = trig_accuracy::accurate )
+    {
+        for( size_t j = 0; j != n; ++j ) out[j] = std::sin( x[j] );
+    }
+
+    template< typename T >
+    inline void cos_block( T const *x, T *out, size_t const & n, trig_accuracy const & = trig_accuracy::accurate )
+    {
+        for( size_t j = 0; j != n; ++j ) out[j] = std::cos( x[j] );
+    }
+
+    inline void sin_block( double const *x, double *out, size_t const & n, trig_accuracy const & accuracy = trig_accuracy::accurate )
+    {
+        if( accuracy == trig_accuracy::fast ) detail::fast_trig_block( x, out, n, 0, best_trig_isa() );
+        else for( size_t j = 0; j != n; ++j ) out[j] = std::sin( x[j] );
+    }
+
+    inline void cos_block( double const *x, double *out, size_t const & n, trig_accuracy const & accuracy = trig_accuracy::accurate )
+    {
+        if( accuracy == trig_accuracy::fast ) detail::fast_trig_block( x, out, n, 1, best_trig_isa() );
+        else for( size_t j = 0; j != n; ++j ) out[j] = std::cos( x[j] );
+    }
+
+    // Units in the last place between two doubles; 0 when both are NaN, infinite when only one is.
+    inline double ulp_distance( double const & a, double const & b )
+    {
+        if( std::isnan( a ) || std::isnan( b ) ) return std::isnan( a ) && std::isnan( b ) ? 0.0 : std::numeric_limits< double >::infinity();
+        std::int64_t ia = 0, ib = 0;
+        std::memcpy( &ia, &a, sizeof( ia ) );
+        std::memcpy( &ib, &b, sizeof( ib ) );
+        // map the sign-magnitude encoding onto a monotonic integer line, so -0 and +0 coincide
+        if( ia < 0 ) ia = std::numeric_limits< std::int64_t >::min() - ia;
+        if( ib < 0 ) ib = std::numeric_limits< std::int64_t >::min() - ib;
+        std::uint64_t const ua = static_cast< std::uint64_t >( ia ), ub = static_cast< std::uint64_t >( ib );
+        return static_cast< double >( ia > ib ? ua - ub : ub - ua );
+    }
+
+    struct trig_report
+    {
+        trig_isa isa;
+        bool cosine;
+        size_t arguments;
+        double max_ulp;
+        double worst_argument;
+        double fast_ns;         // per argument, fast kernel
+        double libm_ns;         // per argument, std::sin / std::cos
+        bool within_bound;      // max_ulp <= fast_trig_max_ulp
+    };
+
+/*
+ *
+ * name: check_trig
+ * @param: number of random arguments, their range, timing repeats
+ * @return: one report for sin and one for cos per kernel the processor can run
+ * Accuracy and throughput of the fast kernels against std::sin / std::cos. Besides uniform arguments in
+ * [ -range, range ] the set holds the hard cases of the reduction: the doubles next to multiples of pi/2 up to
+ * fast_trig_limit, signed zeros, subnormals, the limit itself and infinities and NaN handed to libm.
+ */
+    inline std::vector< trig_report > check_trig( size_t const & samples = 1 << 20, double const & range = 1.0e3, size_t const & repeats = 4 )
+    {
+        using clock = std::chrono::steady_clock;
+        std::vector< double > x {};
+        x.reserve( samples + 4096 );
+        std::mt19937_64 random { 20261019 };
+        std::uniform_real_distribution< double > uniform { -range, range };
+        for( size_t i = 0; i != samples; ++i ) x.push_back( uniform( random ) );
+        for( double k = 1.0; k * 1.5707963267948966 <= fast_trig_limit; k = std::floor( k * 1.05 ) + 1.0 ){
+            double const m = k * 1.5707963267948966;
+            x.push_back( m );
+            x.push_back( -m );
+            x.push_back( std::nextafter( m, 0.0 ) );
+            x.push_back( std::nextafter( m, 2.0 * m ) );
+        }
+        double const special[] = { 0.0, -0.0, 1e-310, -1e-300, 1e-8, 0.7853981633974483, fast_trig_limit, -fast_trig_limit,
+                                   std::nextafter( fast_trig_limit, 2.0 * fast_trig_limit ), 1e22,
+                                   std::numeric_limits< double >::infinity(), -std::numeric_limits< double >::infinity(),
+                                   std::numeric_limits< double >::quiet_NaN() };
+        x.insert( x.end(), std::begin( special ), std::end( special ) );
+
+        std::vector< trig_isa > kernels { trig_isa::scalar };
+#if defined( EXPRESSION_TRIG_X86 )
+        kernels.push_back( trig_isa::sse2 );
+        if( best_trig_isa() == trig_isa::avx2 ) kernels.push_back( trig_isa::avx2 );
+#endif
+        std::vector< double > exact( x.size() ), fast( x.size() );
+        std::vector< trig_report > reports {};
+        for( std::uint64_t shift = 0; shift != 2; ++shift ){
+            auto const start = clock::now();
+            for( size_t r = 0; r != repeats; ++r ){
+                if( shift ) cos_block( x.data(), exact.data(), x.size() ); else sin_block( x.data(), exact.data(), x.size() );
+            }
+            double const libm_ns = std::chrono::duration< double, std::nano >( clock::now() - start ).count() / ( repeats * x.size() );
+            for( auto const isa : kernels ){
+                auto const begin = clock::now();
+                for( size_t r = 0; r != repeats; ++r ) detail::fast_trig_block( x.data(), fast.data(), x.size(), shift, isa );
+                double const fast_ns = std::chrono::duration< double, std::nano >( clock::now() - begin ).count() / ( repeats * x.size() );
+                trig_report report { isa, shift == 1, x.size(), 0.0, 0.0, fast_ns, libm_ns, false };
+                for( size_t i = 0; i != x.size(); ++i ){
+                    double const error = ulp_distance( fast[i], exact[i] );
+                    if( error > report.max_ulp ){
+                        report.max_ulp = error;
+                        report.worst_argument = x[i];
+                    }
+                }
+                report.within_bound = report.max_ulp <= fast_trig_max_ulp;
+                reports.push_back( report );
+            }
+        }
+        return reports;
+    }
+
+    inline std::ostream & operator<<( std::ostream & os, std::vector< trig_report > const & reports )
+    {
+        for( auto const & r : reports ){
+            os << "  " << ( r.cosine ? "cos " : "sin " ) << to_string( r.isa ) << ": max " << r.max_ulp << " ulp at " << r.worst_argument
+               << ( r.within_bound ? " ( within bound ), " : " ( OUT OF BOUND ), " ) << r.fast_ns << " ns fast, " << r.libm_ns << " ns libm\n";
+        }
+        return os;
+    }
+} // namespace Expression
+
+#endif // EXPRESSION_TRIG_H_INCLUDED
@@ -4,6 +4,14 @@
 #include <memory>
 #include <cassert>
 #include <cmath>
+#include <string>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "number_format.hpp"
 
 namespace Expression
 {
@@ -17,9 +25,28 @@ namespace Expression
         Minus ,
         Divides ,
         Multiplies ,
-        UnaryFunc
+        UnaryFunc ,
+        Sum ,
+        Product ,
+        Comparison ,
+        Min ,
+        Max ,
+        Select
     };
     
+    namespace detail {
+
+    inline std::uint64_t hash_mix( std::uint64_t h )
+    {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        return h ^ ( h >> 31 );
+    }
+
+    } // namespace detail
+
     class expr
     {
     public:
@@ -34,6 +61,25 @@ namespace Expression
         virtual expression_type get_type( void ) const = 0;
         virtual std::string to_string( void ) const = 0;
         virtual double eval() const = 0;
+
+        /*
+         * Merkle hash of the subtree: type, constant bits, variable index or function name, and the hashes of the
+         * children in order. Computed on first use and cached in every node of the subtree, which makes those
+         * nodes immutable: a cached hash implies cached hashes below it, so set_children on a node without one
+         * cannot make any cached hash stale, and set_children on a node with one throws std::logic_error.
+         */
+        std::uint64_t structural_hash( void ) const;
+
+    protected:
+
+        void check_mutable( void ) const
+        {
+            if( m_hash.load( std::memory_order_acquire ) != 0 ) throw std::logic_error( "set_children on a node whose structural hash is cached" );
+        }
+
+    private:
+
+        mutable std::atomic< std::uint64_t > m_hash { 0 };     // 0 until computed
     };
     
     using expr_ptr = expr::expr_ptr;
@@ -60,7 +106,7 @@ namespace Expression
         size_t num_children( void ) const override { return 1; }
         const_expr_ptr get_children( size_t i ) const override { assert( i == 0 ) ;return m_child; }
         expr_ptr get_children( size_t i ) override { assert( i == 0 ) ;return m_child; }
-        void set_children( size_t i , expr_ptr e ) override { assert( i == 0 ); m_child = e; }
+        void set_children( size_t i , expr_ptr e ) override { assert( i == 0 ); check_mutable(); m_child = e; }
         
     protected:
     
@@ -78,13 +124,54 @@ namespace Expression
         size_t num_children( void ) const override { return 2; }
         const_expr_ptr get_children( size_t i ) const override { assert( i < 2 ); return m_children[i]; }
         expr_ptr get_children( size_t i ) override { assert( i < 2 ); return m_children[i]; }        
-        void set_children( size_t i , expr_ptr e ) override { assert( i < 2 ); m_children[i] = e; }
+        void set_children( size_t i , expr_ptr e ) override { assert( i < 2 ); check_mutable(); m_children[i] = e; }
         
     protected:
        
         expr_ptr m_children[2];
     };
     
+    class ternary_expr : public expr
+    {
+    public:
+        
+        ternary_expr( expr_ptr first , expr_ptr second , expr_ptr third )
+        : m_children{} { m_children[0] = first; m_children[1] = second; m_children[2] = third; }
+
+        double eval() const override { return 0.0; }
+        size_t num_children( void ) const override { return 3; }
+        const_expr_ptr get_children( size_t i ) const override { assert( i < 3 ); return m_children[i]; }
+        expr_ptr get_children( size_t i ) override { assert( i < 3 ); return m_children[i]; }
+        void set_children( size_t i , expr_ptr e ) override { assert( i < 3 ); check_mutable(); m_children[i] = e; }
+        
+    protected:
+       
+        expr_ptr m_children[3];
+    };
+    
+    /*
+     * Associative operator over any number of operands, stored contiguously. Sum and Product nodes are produced
+     * by flatten() and evaluate left to right, i.e. like the left-leaning binary tree they print as.
+     */
+    class nary_expr : public expr
+    {
+    public:
+        
+        nary_expr( std::vector< expr_ptr > children )
+        : m_children( std::move( children ) ) {}
+
+        double eval() const override { return 0.0; }
+        size_t num_children( void ) const override { return m_children.size(); }
+        const_expr_ptr get_children( size_t i ) const override { assert( i < m_children.size() ); return m_children[i]; }
+        expr_ptr get_children( size_t i ) override { assert( i < m_children.size() ); return m_children[i]; }
+        void set_children( size_t i , expr_ptr e ) override { assert( i < m_children.size() ); check_mutable(); m_children[i] = e; }
+        std::vector< expr_ptr > const & children( void ) const { return m_children; }
+        
+    protected:
+       
+        std::vector< expr_ptr > m_children;
+    };
+    
     class constant : public terminal_expr
     {
     public:
@@ -94,7 +181,7 @@ namespace Expression
         expression_type get_type( void ) const final { return Constant; }
         std::string to_string( void ) const final
         {
-            return std::to_string( m_c );
+            return format_double( m_c );
         }
         
     private:
@@ -115,14 +202,23 @@ namespace Expression
         std::array<double, 20> elements { { 11.8, 15,9, 11.9, 1, 12, 12, 24, 6, 45, 45, 6 } };
     };
     
-    template< size_t I >
-    class variable : public terminal_expr, context_expr_eval
+    class variable_expr : public terminal_expr
     {
+    public:
+        variable_expr( int const & index ): terminal_expr {}, m_index { index } { }
+        int get_index( void ) const { return m_index; }
+        expression_type get_type( void ) const override { return Variable; }
+
+    protected:
         int m_index;
+    };
+    
+    template< size_t I >
+    class variable : public variable_expr, context_expr_eval
+    {
     public:
-        variable( int const & index = I ): terminal_expr {}, context_expr_eval {}, m_index { index } { }
+        variable( int const & index = I ): variable_expr { index }, context_expr_eval {} { }
         double eval() const override { return context_expr_eval::get( m_index ); }
-        expression_type get_type( void ) const override { return Variable; }
         std::string to_string( void ) const override {
             return std::string { "var" + std::to_string( m_index ) };
         }
@@ -179,6 +275,94 @@ namespace Expression
         std::string to_string( void ) const override { return "/"; }
     };
     
+    /*
+     * Comparisons evaluate to 1.0 when they hold and 0.0 otherwise. Like sin and cos they share one expression_type
+     * and are told apart by to_string().
+     */
+    class less_node : public binary_expr
+    {
+    public:
+        less_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Comparison; }
+        std::string to_string( void ) const override { return "<"; }
+    };
+    
+    class less_equal_node : public binary_expr
+    {
+    public:
+        less_equal_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Comparison; }
+        std::string to_string( void ) const override { return "<="; }
+    };
+    
+    class greater_node : public binary_expr
+    {
+    public:
+        greater_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Comparison; }
+        std::string to_string( void ) const override { return ">"; }
+    };
+    
+    class greater_equal_node : public binary_expr
+    {
+    public:
+        greater_equal_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Comparison; }
+        std::string to_string( void ) const override { return ">="; }
+    };
+    
+    class equal_node : public binary_expr
+    {
+    public:
+        equal_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Comparison; }
+        std::string to_string( void ) const override { return "=="; }
+    };
+    
+    // min( a , b ) is b < a ? b : a and max( a , b ) is a < b ? b : a, as std::min and std::max
+    class min_node : public binary_expr
+    {
+    public:
+        min_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Min; }
+        std::string to_string( void ) const override { return "min"; }
+    };
+    
+    class max_node : public binary_expr
+    {
+    public:
+        max_node( expr_ptr left , expr_ptr right ) : binary_expr{ left , right } { }
+        expression_type get_type( void ) const override { return Max; }
+        std::string to_string( void ) const override { return "max"; }
+    };
+    
+    // select( cond , a , b ) is a where cond is non-zero and b otherwise
+    class select_node : public ternary_expr
+    {
+    public:
+        select_node( expr_ptr cond , expr_ptr a , expr_ptr b ) : ternary_expr{ cond , a , b } { }
+        expression_type get_type( void ) const override { return Select; }
+        std::string to_string( void ) const override { return "select"; }
+    };
+    
+    class sum_node : public nary_expr
+    {
+    public:
+        
+        sum_node( std::vector< expr_ptr > children ) : nary_expr{ std::move( children ) } { }
+        expression_type get_type( void ) const override { return Sum; }
+        std::string to_string( void ) const override { return "+"; }
+    };
+    
+    class product_node : public nary_expr
+    {
+    public:
+        
+        product_node( std::vector< expr_ptr > children ) : nary_expr{ std::move( children ) } { }
+        expression_type get_type( void ) const override { return Product; }
+        std::string to_string( void ) const override { return "*"; }
+    };
+    
     expr_ptr make_constant( double c ) { return std::make_shared< constant >( c ); }
     
     template< size_t I>
@@ -187,12 +371,111 @@ namespace Expression
     template< size_t I = 0>
     expr_ptr make_variable_with_index( int const & index ) { return std::make_shared< variable< I > >( index ); }
     
+    inline int get_variable_index( const_expr_ptr const & e )
+    {
+        assert( e->get_type() == Variable );
+        return static_cast< variable_expr const * >( e.get() )->get_index();
+    }
+
+    inline std::uint64_t expr::structural_hash( void ) const
+    {
+        std::uint64_t const cached = m_hash.load( std::memory_order_acquire );
+        if( cached != 0 ) return cached;
+
+        std::uint64_t payload = 0;
+        switch( get_type() ){
+            case Constant: {
+                double const value = eval();    // by bits: 0.0 and -0.0 differ, e.g. in 1 / x
+                std::memcpy( &payload, &value, sizeof( payload ) );
+                break;
+            }
+            case Variable:
+                payload = static_cast< std::uint64_t >( static_cast< variable_expr const * >( this )->get_index() );
+                break;
+            case UnaryFunc: case Comparison:
+                payload = 0xcbf29ce484222325ull;
+                for( char const c : to_string() ) payload = ( payload ^ static_cast< unsigned char >( c ) ) * 0x100000001b3ull;
+                break;
+            default:
+                break;
+        }
+        std::uint64_t h = detail::hash_mix( detail::hash_mix( static_cast< std::uint64_t >( get_type() ) + 1 ) ^ payload );
+        for( size_t i = 0; i != num_children(); ++i ){
+            h = detail::hash_mix( h * 31 + get_children( i )->structural_hash() );
+        }
+        if( h == 0 ) h = 1;
+        m_hash.store( h, std::memory_order_release );
+        return h;
+    }
+    
     expr_ptr make_sin( expr_ptr child ) { return std::make_shared< sin_node >( child ); }
     expr_ptr make_cos( expr_ptr child ) { return std::make_shared< cos_node >( child ); }
     expr_ptr make_plus( expr_ptr left , expr_ptr right ) { return std::make_shared< plus_node >( left , right ); }
     expr_ptr make_minus( expr_ptr left , expr_ptr right ) { return std::make_shared< minus_node >( left , right ); }
     expr_ptr make_multiplies( expr_ptr left , expr_ptr right ) { return std::make_shared< multiplies_node >( left , right ); }
     expr_ptr make_divided( expr_ptr left , expr_ptr right ) { return std::make_shared< divides_node >( left , right ); }
+    expr_ptr make_sum( std::vector< expr_ptr > children ) { return std::make_shared< sum_node >( std::move( children ) ); }
+    expr_ptr make_product( std::vector< expr_ptr > children ) { return std::make_shared< product_node >( std::move( children ) ); }
+    expr_ptr make_less( expr_ptr left , expr_ptr right ) { return std::make_shared< less_node >( left , right ); }
+    expr_ptr make_less_equal( expr_ptr left , expr_ptr right ) { return std::make_shared< less_equal_node >( left , right ); }
+    expr_ptr make_greater( expr_ptr left , expr_ptr right ) { return std::make_shared< greater_node >( left , right ); }
+    expr_ptr make_greater_equal( expr_ptr left , expr_ptr right ) { return std::make_shared< greater_equal_node >( left , right ); }
+    expr_ptr make_equal( expr_ptr left , expr_ptr right ) { return std::make_shared< equal_node >( left , right ); }
+    expr_ptr make_min( expr_ptr left , expr_ptr right ) { return std::make_shared< min_node >( left , right ); }
+    expr_ptr make_max( expr_ptr left , expr_ptr right ) { return std::make_shared< max_node >( left , right ); }
+    expr_ptr make_select( expr_ptr cond , expr_ptr a , expr_ptr b ) { return std::make_shared< select_node >( cond , a , b ); }
+    
+    // The comparison node for one of "<", "<=", ">", ">=" and "==".
+    inline expr_ptr make_comparison( std::string const & op , expr_ptr left , expr_ptr right )
+    {
+        if( op == "<" ) return make_less( left , right );
+        if( op == "<=" ) return make_less_equal( left , right );
+        if( op == ">" ) return make_greater( left , right );
+        if( op == ">=" ) return make_greater_equal( left , right );
+        assert( op == "==" );
+        return make_equal( left , right );
+    }
+    
+    inline bool compare_values( std::string const & op , double const & left , double const & right )
+    {
+        if( op == "<" ) return left < right;
+        if( op == "<=" ) return left <= right;
+        if( op == ">" ) return left > right;
+        if( op == ">=" ) return left >= right;
+        return left == right;
+    }
+    
+    // Creates a fresh node of the same kind as e ( same constant, variable index or function ) with the given children.
+    inline expr_ptr make_node_like( const_expr_ptr const & e , expr_ptr left = nullptr , expr_ptr right = nullptr , expr_ptr third = nullptr )
+    {
+        switch( e->get_type() ){
+            case Comparison:    return make_comparison( e->to_string() , left , right );
+            case Min:           return make_min( left , right );
+            case Max:           return make_max( left , right );
+            case Select:        return make_select( left , right , third );
+            case Constant:      return make_constant( e->eval() );
+            case Variable:      return make_variable_with_index<>( get_variable_index( e ) );
+            case Plus:          return make_plus( left , right );
+            case Minus:         return make_minus( left , right );
+            case Divides:       return make_divided( left , right );
+            case Multiplies:    return make_multiplies( left , right );
+            case Sum:           return make_sum( { left , right } );
+            case Product:       return make_product( { left , right } );
+            case UnaryFunc: case None: default:
+                return e->to_string() == std::string { "cos" } ? make_cos( left ) : make_sin( left );
+        }
+    }
+    
+    inline expr_ptr make_node_like( const_expr_ptr const & e , std::vector< expr_ptr > children )
+    {
+        switch( e->get_type() ){
+            case Sum:           return make_sum( std::move( children ) );
+            case Product:       return make_product( std::move( children ) );
+            default:
+                children.resize( 3 );
+                return make_node_like( e , children[0] , children[1] , children[2] );
+        }
+    }
 }
 #endif // EXPRESSIONS_H_INCLUDED
 
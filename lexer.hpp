@@ -2,6 +2,9 @@
 #define LEXER_H_INCLUDED
 
 #include "expressions.hpp"
+#include <string>
+#include <cstdio>
+#include <cstdlib>
 
 namespace EditedExpression
 {
@@ -154,7 +157,18 @@ namespace EditedExpression
             update_current_token();
             return { Symbol { str_buf }, expression_type::Variable };
         }
-        //TODO
+        // "<", "<=", ">", ">=" or "=="
+        token_type get_comparison_token()
+        {
+            std::string str_buf( 1, current_character );
+            update_current_token();
+            if( current_character == '=' ){
+                str_buf.push_back( '=' );
+                update_current_token();
+            }
+            if( str_buf == "=" ) panic( str_lex, current_index );
+            return { Symbol { str_buf }, expression_type::Comparison };
+        }
         
         token_type get_token()
         {
@@ -177,6 +191,8 @@ namespace EditedExpression
                         return { Symbol { "+" }, expression_type::Plus };
                     case '-':
                         return get_negated_constant_or_unary_minus();
+                    case '<': case '>': case '=':
+                        return get_comparison_token();
                     case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': case '0':
                         return get_constant_token();
                     default:
@@ -8,6 +8,24 @@
  */
 
 #include "expression_io.hpp"
+#include "expression_plan.hpp"
+#include "expression_specialize.hpp"
+#include "expression_peephole.hpp"
+#include "expression_stats.hpp"
+#include "expression_precision.hpp"
+#include "expression_pipeline.hpp"
+#include "expression_persistent.hpp"
+#include "expression_rewrite.hpp"
+#include "expression_constexpr.hpp"
+#include "expression_parallel.hpp"
+#include "expression_diff.hpp"
+#include "expression_polynomial.hpp"
+#include "expression_registry.hpp"
+#include "expression_streaming.hpp"
+#include "expression_shapes.hpp"
+#include "expression_store.hpp"
+#include "expression_hash.hpp"
+#include "expression_trig.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -44,6 +62,144 @@ int main( int argc , char *argv[] )
     auto root4 = make_plus( make_plus( make_variable<0>(), make_constant( 1 ) ), make_plus( make_plus( make_constant( -2 ), make_variable<1>() ), make_sin( make_variable<2>() )) ) ;
     
     std::cout << evaluate_expr( linearize( root4 ) )<< std::endl;
+
+    auto plan = make_plan( { root1, root2, root4 } );
+    auto outputs = plan.evaluate();
+    std::cout << "Fused plan ( " << plan.num_instructions() << " instructions ):";
+    for( auto const & value : outputs ) std::cout << " " << value;
+    std::cout << std::endl;
+
+    auto residual = specialize( root2, { { 10, 45.0 } } );
+    std::cout << "Specialized Expr2 : " << to_polish( residual ) << " = " << evaluate_expr( residual ) << std::endl;
+
+    auto fourth_power = make_plus( make_multiplies( make_multiplies( make_multiplies( make_variable<3>(), make_variable<3>() ), make_variable<3>() ),
+                                                    make_variable<3>() ),
+                                   make_divided( make_variable<4>(), make_constant( 4.0 ) ) );
+    peephole_options options {};
+    options.divide_by_reciprocal = true;
+    peephole_report report {};
+    auto power_plan = make_plan( { fourth_power } );
+    auto lowered = lower_peephole( power_plan, options, &report );
+    time_peephole( power_plan, lowered, report );
+    std::cout << "Peephole: " << report.ops_before << " -> " << report.ops_after << " ops, "
+              << report.ns_per_row_before << " -> " << report.ns_per_row_after << " ns/row, "
+              << evaluate_expr( fourth_power ) << " == " << lowered.evaluate()[0] << std::endl;
+
+    expr_ptr long_sum = make_variable<0>();
+    for( int i = 1; i != 1000; ++i ) long_sum = make_plus( long_sum, make_variable_with_index<>( i % 12 ) );
+    auto flat = flatten( long_sum );
+    std::cout << "Flattened sum with " << flat->num_children() << " operands: " << evaluate_expr( flat )
+              << " == " << evaluate_expr( from_polish( to_polish( flat ) ) ) << std::endl;
+
+    std::cout << "Memory of Expr2:\n" << memory_stats( root2 );
+
+    std::cout << "Expr2 in float: " << evaluate_expr< float >( root2 ) << ", " << compare_precision( plan );
+
+    std::vector< std::string > corpus {};
+    for( int i = 0; i != 10000; ++i ) corpus.push_back( to_polish( i % 2 ? root2 : root4 ) );
+    pipeline_options pipeline {};
+    pipeline.linearize = true;
+    pipeline_report pipeline_stats {};
+    auto pipeline_results = run_pipeline( corpus, pipeline, &pipeline_stats );
+    std::cout << "Pipeline results: " << pipeline_results[0] << " " << pipeline_results[1] << "\n" << pipeline_stats;
+
+    persistent_expr versions { root2 };
+    auto version0 = versions.snapshot();
+    versions.replace( { 1, 0, 1 }, make_constant( 2.0 ) );
+    std::cout << "Version " << versions.version() << ": " << to_polish( versions.snapshot() ) << " = " << evaluate_expr( versions.snapshot() )
+              << ", version 0 still " << evaluate_expr( version0 ) << std::endl;
+
+    rewrite_report rewrites {};
+    auto rewritten = rewrite( root4, linearize_rules(), &rewrites );
+    std::cout << "Rule-based linearize: " << to_polish( rewritten ) << " ( " << rewrites.rewrites << " rewrites ), linearize: "
+              << to_polish( linearize( root4 ) ) << std::endl;
+    expr_ptr chain = make_variable_with_index<>( 0 );
+    for( int i = 1; i != 10; ++i ) chain = make_plus( chain, make_variable_with_index<>( i ) );
+    auto shared_chain = make_plus( root4, make_plus( make_plus( make_variable_with_index<>( 1 ), make_variable_with_index<>( 2 ) ), root4 ) );
+    auto linear_chain = rewrite( chain, linearize_rules() ), linear_shared = rewrite( shared_chain, linearize_rules() );
+    std::cout << "Rule-based linearize of a 10-term chain: " << to_polish( linear_chain ) << ", " << evaluate_expr( chain ) << " == "
+              << evaluate_expr( linear_chain ) << ", shared: " << evaluate_expr( shared_chain ) << " == " << evaluate_expr( linear_shared ) << std::endl;
+
+    constexpr auto compiled = POLISH_PROGRAM( "*|+|var10|1|+|+|11|var1|sin|var10" );
+    static_assert( compiled.size() == 10, "Expr2 has ten tokens" );
+    std::cout << "Compile-time Expr2: " << compiled.evaluate() << std::endl;
+    constexpr auto clamped = POLISH_PROGRAM( "select|<=|var1|var2|max|var1|-3|min|var2|*|2|var1" );
+    std::cout << "Compile-time select: " << clamped.evaluate() << " == "
+              << evaluate_expr( from_polish( "select|<=|var1|var2|max|var1|-3|min|var2|*|2|var1" ) ) << std::endl;
+
+    auto edited_sum = replace_at( replace_at( flat, { 17 }, make_sin( make_variable<5>() ) ), { 900 }, make_constant( 0.5 ) );
+    auto edits = from_edit_string( to_edit_string( diff( flat, edited_sum ) ) );
+    std::cout << "Diff of the flattened sum: " << to_edit_string( edits ).size() << " bytes instead of " << to_polish( edited_sum ).size()
+              << ", patched " << evaluate_expr( patch( flat, edits ) ) << " == " << evaluate_expr( edited_sum ) << std::endl;
+
+    expr_ptr quartic = make_constant( 1.0 );
+    for( int k = 1; k <= 4; ++k ){
+        expr_ptr term = make_constant( k + 1.0 );
+        for( int j = 0; j != k; ++j ) term = make_multiplies( term, make_variable<0>() );
+        quartic = make_plus( quartic, term );
+    }
+    polynomial_report horner {};
+    auto horner_quartic = horner_form( quartic, polynomial_options {}, &horner );
+    std::cout << "Horner: " << to_polish( horner_quartic ) << ", " << horner.multiplications_before << " -> " << horner.multiplications_after
+              << " multiplications, " << evaluate_expr( quartic ) << " == " << evaluate_expr( horner_quartic ) << std::endl;
+
+    std::cout << "Registry under updates, " << stress_registry();
+
+    auto latency = time_polish_evaluation( to_polish( root2 ) );
+    std::cout << "Streaming Expr2: " << evaluate_polish( to_polish( root2 ) ) << ", " << latency.tree_ns << " ns with a tree, "
+              << latency.streaming_ns << " ns streamed, " << ( latency.identical ? "identical" : "different" ) << std::endl;
+
+    std::vector< const_expr_ptr > family {};
+    for( int i = 0; i != 100000; ++i ){
+        family.push_back( i % 10 ? make_plus( make_sin( make_variable_with_index<>( i % 12 ) ), make_constant( i * 0.25 ) ) : root2 );
+    }
+    auto shapes = time_shapes( family );
+    std::cout << "Shape groups: " << shapes.expressions << " expressions in " << shapes.shapes << " shapes, " << shapes.tree_ns
+              << " ns per tree walk, " << shapes.grouped_ns << " ns grouped, " << ( shapes.identical ? "identical" : "different" ) << std::endl;
+
+    write_store( "expressions.store", { { "expr1", root1 }, { "expr2", root2 }, { "expr4", root4 }, { "long_sum", flat } } );
+    expression_store store { "expressions.store" };
+    std::cout << "Store of " << store.size() << " expressions, expr2 mapped: " << store.evaluate( store.find( "expr2" ) )
+              << ", materialized: " << to_polish( store.get( store.find( "expr2" ) ) ) << std::endl;
+
+    std::vector< const_expr_ptr > parsed {};
+    for( auto const & text : corpus ) parsed.push_back( from_polish( text ) );
+    dedup_report dedup {};
+    deduplicate( parsed, &dedup );
+    std::cout << "Deduplicated " << dedup.expressions << " parsed expressions to " << dedup.unique << ", Expr2 hash "
+              << root2->structural_hash() << " == " << root3->structural_hash() << std::endl;
+
+    auto clamp = make_select( make_less( make_variable_with_index<>( 0 ), make_constant( 0 ) ), make_constant( 0 ),
+                              make_min( make_variable_with_index<>( 0 ), make_constant( 10 ) ) );
+    auto clamp_plan = make_plan( { from_polish( to_polish( clamp ) ) } );
+    std::vector< double > clamp_in { -3.0, 0.5, 4.0, 12.0, -0.0, 10.0, 7.5, 100.0 }, clamp_out( clamp_in.size() );
+    double const *clamp_columns[] = { clamp_in.data() };
+    double *clamp_outputs[] = { clamp_out.data() };
+    plan_workspace clamp_ws {};
+    clamp_plan.evaluate_batch( clamp_columns, clamp_in.size(), clamp_outputs, clamp_ws );
+    std::cout << "Clamp " << to_polish( clamp ) << ": " << evaluate_expr( clamp ) << " == " << clamp_plan.evaluate()[0] << ", batch";
+    for( double const value : clamp_out ) std::cout << " " << value;
+    std::cout << std::endl;
+
+    auto wave = from_polish( "+|sin|var0|*|cos|var1|sin|*|var0|var1" );
+    auto wave_plan = make_plan( { wave } );
+    std::vector< double > wave_x( 4096 ), wave_y( 4096 ), wave_accurate( 4096 ), wave_fast( 4096 );
+    for( size_t i = 0; i != wave_x.size(); ++i ){
+        wave_x[i] = -50.0 + 0.025 * i;
+        wave_y[i] = 0.5 + 0.001 * i;
+    }
+    double const *wave_columns[] = { wave_x.data(), wave_y.data() };
+    double *wave_accurate_out[] = { wave_accurate.data() }, *wave_fast_out[] = { wave_fast.data() };
+    plan_workspace wave_ws {};
+    wave_plan.evaluate_batch( wave_columns, wave_x.size(), wave_accurate_out, wave_ws );
+    wave_ws.trig = trig_accuracy::fast;
+    wave_plan.evaluate_batch( wave_columns, wave_x.size(), wave_fast_out, wave_ws );
+    double wave_error = 0.0;
+    for( size_t i = 0; i != wave_x.size(); ++i ) wave_error = std::max( wave_error, std::fabs( wave_fast[i] - wave_accurate[i] ) );
+    std::cout << "Fast trig ( " << to_string( best_trig_isa() ) << " ) on " << to_polish( wave ) << ": max abs difference "
+              << wave_error << "\n" << check_trig( 1 << 18 );
+
+    std::cout << "Parallel Expr2 over " << ( 1 << 22 ) << " rows:\n" << time_parallel( make_plan( { root2 } ) );
     return 0;
 }
 
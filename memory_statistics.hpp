@@ -0,0 +1,95 @@
+#ifndef MEMORY_STATISTICS_H_INCLUDED
+#define MEMORY_STATISTICS_H_INCLUDED
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+namespace Expression
+{
+    /*
+     * The report of memory_stats, shared by the index-based tree ( expression_stats.hpp ) and the named variant
+     * ( expr/edited_expression_stats.hpp ); Type is the node type enum of the variant.
+     */
+    template< typename Type >
+    struct basic_memory_statistics
+    {
+        std::map< Type, size_t > nodes_by_type;
+        size_t unique_nodes = 0;
+        size_t shared_nodes = 0;
+        size_t references = 0;
+        size_t depth = 0;
+        size_t payload_bytes = 0;
+        size_t control_block_bytes = 0;
+        size_t string_bytes = 0;
+
+        size_t total_bytes( void ) const { return payload_bytes + control_block_bytes + string_bytes; }
+    };
+
+    namespace detail {
+
+    // vtable pointer, use count and weak count of the in-place control block
+    constexpr size_t control_block_estimate = sizeof( void * ) + 2 * sizeof( int );
+
+/*
+ *
+ * name: memory_walk
+ * @param: root, and for a node: its number of children, its payload bytes and its string bytes
+ * @return: basic_memory_statistics
+ * Walks the tree once, iteratively, visiting every distinct node a single time, so DAGs are not double counted and
+ * deep chains cannot overflow the stack. references counts every parent-to-child edge plus the root, i.e. the node
+ * count the same expression would have as a tree; shared_nodes counts nodes reached through more than one edge.
+ */
+    template< typename Type, typename Ptr, typename Children, typename Payload, typename Strings >
+    inline basic_memory_statistics< Type > memory_walk( Ptr const & root, Children children, Payload payload, Strings strings )
+    {
+        struct node_info { size_t references; size_t depth; };
+        struct frame { Ptr node; size_t next_child; };
+        using node_type = typename Ptr::element_type;
+
+        basic_memory_statistics< Type > stats {};
+        if( !root ) return stats;
+
+        std::unordered_map< node_type const *, node_info > seen {};
+        std::vector< frame > pending {};
+
+        auto visit = [&]( Ptr const & e ){
+            ++stats.references;
+            auto found = seen.find( e.get() );
+            if( found != seen.end() ){
+                if( ++found->second.references == 2 ) ++stats.shared_nodes;
+                return;
+            }
+            seen.insert( { e.get(), node_info { 1, 0 } } );
+            ++stats.unique_nodes;
+            ++stats.nodes_by_type[ e->get_type() ];
+            stats.payload_bytes += payload( e );
+            stats.control_block_bytes += control_block_estimate;
+            stats.string_bytes += strings( e );
+            pending.push_back( frame { e, 0 } );
+        };
+
+        visit( root );
+        while( !pending.empty() ){
+            frame & top = pending.back();
+            if( top.next_child < children( top.node ) ){
+                Ptr child = top.node->get_children( top.next_child++ );
+                visit( child );
+                continue;
+            }
+            size_t depth = 0;
+            for( size_t i = 0; i != children( top.node ); ++i ){
+                depth = std::max( depth, seen[ top.node->get_children( i ).get() ].depth );
+            }
+            seen[ top.node.get() ].depth = depth + 1;
+            pending.pop_back();
+        }
+        stats.depth = seen[ root.get() ].depth;
+        return stats;
+    }
+
+    } // namespace detail
+} // namespace Expression
+
+#endif // MEMORY_STATISTICS_H_INCLUDED
@@ -0,0 +1,152 @@
+#ifndef NUMBER_FORMAT_H_INCLUDED
+#define NUMBER_FORMAT_H_INCLUDED
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+namespace Expression
+{
+    namespace detail {
+
+    // 10^k for 0 <= k <= 22, all exactly representable as doubles
+    inline double exact_power_of_ten( int const & k )
+    {
+        static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+                                         1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        return powers[k];
+    }
+
+    constexpr double two_to_53 = 9007199254740992.0;
+
+    // Appends the decimal digits of `digits` with a decimal point placed `point` digits from the left, padding with
+    // zeros on either side as needed, e.g. ( "123", 0 ) -> "0.123", ( "5", -2 ) -> "0.005", ( "12", 4 ) -> "1200".
+    inline void append_fixed( std::string & out, std::string const & digits, int const & point )
+    {
+        int const n = static_cast< int >( digits.size() );
+        if( point <= 0 ){
+            out += "0.";
+            out.append( static_cast< size_t >( -point ), '0' );
+            out += digits;
+        } else if( point >= n ){
+            out += digits;
+            out.append( static_cast< size_t >( point - n ), '0' );
+        } else {
+            out.append( digits, 0, point );
+            out += '.';
+            out.append( digits, point, std::string::npos );
+        }
+    }
+
+    inline std::string integer_digits( std::uint64_t m )
+    {
+        char buffer[24];
+        char *p = buffer + sizeof( buffer );
+        do {
+            *--p = static_cast< char >( '0' + m % 10 );
+            m /= 10;
+        } while( m );
+        return std::string( p, buffer + sizeof( buffer ) );
+    }
+
+    } // namespace detail
+
+/*
+ *
+ * name: format_double
+ * @param: value
+ * @return: shortest fixed-point decimal that reads back as exactly the same double
+ * The Lexer only understands digits, '.' and a leading '-', so no exponent is ever written. The common case is
+ * handled with integer arithmetic: the smallest k for which round( |v| * 10^k ) / 10^k == |v| gives the digits,
+ * and since both the scaling and the check are single correctly rounded operations on exact values, the string
+ * is guaranteed to round-trip. Other values are printed correctly rounded to 15, then 16 significant digits ( from
+ * one digit up for subnormals ), and the first that reads back as the same double is kept; 17 always round-trip.
+ */
+    inline std::string format_double( double value )
+    {
+        if( std::isnan( value ) ) return "nan";
+        std::string out {};
+        if( std::signbit( value ) ){
+            out += '-';
+            value = -value;
+        }
+        if( std::isinf( value ) ) return out + "inf";
+
+        for( int k = 0; k <= 22; ++k ){
+            double const scaled = value * detail::exact_power_of_ten( k );
+            if( scaled >= detail::two_to_53 ) break;
+            std::uint64_t const m = static_cast< std::uint64_t >( std::llround( scaled ) );
+            if( static_cast< double >( m ) / detail::exact_power_of_ten( k ) == value ){
+                std::string const digits = detail::integer_digits( m );
+                detail::append_fixed( out, digits, static_cast< int >( digits.size() ) - k );
+                return out;
+            }
+        }
+
+        // buffer is d.ddd...e[+-]xx; the character after the first digit is the locale's decimal point. Each
+        // precision is rounded once from the exact value, so 15 or 16 digits are used whenever they read back.
+        // Subnormals carry fewer bits, so for them the search starts at one digit.
+        char buffer[40];
+        std::string digits {};
+        int exponent = 0;
+        for( int precision = value < std::numeric_limits< double >::min() ? 1 : 15; precision <= 17; ++precision ){
+            std::snprintf( buffer, sizeof( buffer ), "%.*e", precision - 1, value );
+            if( precision < 17 && std::strtod( buffer, nullptr ) != value ) continue;
+            digits.assign( 1, buffer[0] );
+            char const *p = buffer + 2;
+            for( ; *p >= '0' && *p <= '9'; ++p ) digits += *p;
+            exponent = std::atoi( p + 1 );
+            break;
+        }
+        while( digits.size() > 1 && digits.back() == '0' ) digits.pop_back();
+        detail::append_fixed( out, digits, exponent + 1 );
+        return out;
+    }
+
+/*
+ *
+ * name: parse_double
+ * @param: decimal string as produced by the Lexer ( optional '-', digits, optional '.' and digits )
+ * @return: the correctly rounded double
+ * When the significant digits fit in 2^53 and there are at most 22 fractional digits the value is one exact
+ * division ( Clinger's fast path ), which is correctly rounded by IEEE arithmetic; anything else goes to strtod.
+ */
+    inline double parse_double( char const *first, char const *last )
+    {
+        char const *p = first;
+        bool const negative = p != last && *p == '-';
+        if( negative ) ++p;
+
+        std::uint64_t mantissa = 0;
+        int fraction_digits = 0, significant = 0;
+        bool seen_point = false, seen_digit = false;
+        for( ; p != last; ++p ){
+            if( *p >= '0' && *p <= '9' ){
+                seen_digit = true;
+                if( significant > 0 || *p != '0' ) ++significant;
+                if( significant > 19 ) break;
+                mantissa = mantissa * 10 + static_cast< std::uint64_t >( *p - '0' );
+                if( seen_point ) ++fraction_digits;
+            } else if( *p == '.' && !seen_point ){
+                seen_point = true;
+            } else {
+                break;
+            }
+        }
+        if( p == last && seen_digit && mantissa <= static_cast< std::uint64_t >( detail::two_to_53 ) && fraction_digits <= 22 ){
+            double const result = static_cast< double >( mantissa ) / detail::exact_power_of_ten( fraction_digits );
+            return negative ? -result : result;
+        }
+        return std::strtod( std::string( first, last ).c_str(), nullptr );
+    }
+
+    inline double parse_double( std::string const & str )
+    {
+        return parse_double( str.data(), str.data() + str.size() );
+    }
+} // namespace Expression
+
+#endif // NUMBER_FORMAT_H_INCLUDED